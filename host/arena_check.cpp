@@ -0,0 +1,373 @@
+/*
+ * checks the sample arena of sample_arena.h
+ *
+ * - random alloc, shrink, free and retire with the compaction running in between,
+ *   the address order, the free lists and the content of every used extent are checked after each step
+ * - the player renders a pattern in one thread while a second thread compacts the arena below it,
+ *   the output must be identical to the same pattern rendered without compaction
+ *
+ * the longest call of SampleArena_Service is printed next to the time of one memmove of all used samples
+ * (what deleting a record cost before)
+ *
+ * usage: arena_check [-n steps]
+ *
+ * returns 1 when an invariant is broken or the output differs
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "config.h"
+#include "audio_task.h"
+
+#include "host_util.h"
+
+#define ARENA_CHECK_LEN         (256 * 1024) /* samples of the arena in the random test */
+#define ARENA_CHECK_RENDER      1000 /* blocks rendered by the concurrent test */
+
+static uint32_t errors = 0;
+
+static void ArenaCheck_Error(const char *msg, uint32_t step)
+{
+    if (errors < 10)
+    {
+        printf("step %u: %s\n", step, msg);
+    }
+    errors++;
+}
+
+static inline uint64_t ArenaCheck_Now(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the content of an extent is derived from its handle and a tag which changes with each allocation */
+static inline int16_t ArenaCheck_Value(uint32_t tag, uint32_t n)
+{
+    return (int16_t)((tag * 2654435761u + n * 40503u) >> 16);
+}
+
+/*
+ * walks the extents in address order and compares them with the free lists
+ */
+static void ArenaCheck_Invariants(uint32_t step)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    int16_t *addr = sampleArena.base;
+    uint32_t total = 0;
+    uint32_t freeCount = 0;
+    uint8_t prev = SAMPLE_ARENA_NONE;
+
+    for (uint8_t h = sampleArena.first; h != SAMPLE_ARENA_NONE; h = ext[h].next)
+    {
+        if ((ext[h].data != addr) || (ext[h].prev != prev) || (ext[h].len == 0) || ((ext[h].len % SAMPLE_ARENA_ALIGN) != 0))
+        {
+            ArenaCheck_Error("extents are not contiguous", step);
+            return;
+        }
+        if ((ext[h].state == sample_extent_free) && (prev != SAMPLE_ARENA_NONE) && (ext[prev].state == sample_extent_free))
+        {
+            ArenaCheck_Error("free neighbours are not merged", step);
+        }
+        if (ext[h].state == sample_extent_free)
+        {
+            freeCount++;
+        }
+        addr += ext[h].len;
+        total += ext[h].len;
+        prev = h;
+    }
+    if (total != sampleArena.len)
+    {
+        ArenaCheck_Error("extents do not cover the arena", step);
+    }
+
+    for (int c = 0; c < SAMPLE_ARENA_CLASSES; c++)
+    {
+        if (((sampleArena.freeMask >> c) & 1) != (sampleArena.freeList[c] != SAMPLE_ARENA_NONE))
+        {
+            ArenaCheck_Error("free mask does not match the lists", step);
+        }
+        for (uint8_t h = sampleArena.freeList[c]; h != SAMPLE_ARENA_NONE; h = ext[h].nextFree)
+        {
+            if ((ext[h].state != sample_extent_free) || (SampleArena_Class(ext[h].len) != c))
+            {
+                ArenaCheck_Error("free list holds a wrong extent", step);
+            }
+            freeCount--;
+        }
+    }
+    if (freeCount != 0)
+    {
+        ArenaCheck_Error("free extent missing in the free lists", step);
+    }
+}
+
+/* readers of the random test, a retired extent stays in use while its reader points into it */
+static const int16_t *arenaCheckReader[SAMPLE_ARENA_EXTENTS + 1];
+
+static void ArenaCheck_Remap(const int16_t *from, int16_t *to, uint32_t len)
+{
+    for (int i = 0; i <= SAMPLE_ARENA_EXTENTS; i++)
+    {
+        if ((arenaCheckReader[i] >= from) && (arenaCheckReader[i] < from + len))
+        {
+            arenaCheckReader[i] = to + (arenaCheckReader[i] - from);
+        }
+    }
+}
+
+static bool ArenaCheck_InUse(const int16_t *data, uint32_t len)
+{
+    for (int i = 0; i <= SAMPLE_ARENA_EXTENTS; i++)
+    {
+        if ((arenaCheckReader[i] >= data) && (arenaCheckReader[i] < data + len))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ArenaCheck_Random(uint32_t steps)
+{
+    static int16_t memory[ARENA_CHECK_LEN + SAMPLE_ARENA_ALIGN];
+    uint32_t tag[SAMPLE_ARENA_EXTENTS + 1] = {0};
+    uint32_t len[SAMPLE_ARENA_EXTENTS + 1] = {0};
+    uint32_t seq = 0;
+    uint32_t noise = 0x2468ACE1;
+    uint32_t failed = 0;
+
+    SampleArena_Init(memory, sizeof(memory));
+    sampleArena_remapCb = ArenaCheck_Remap;
+    sampleArena_inUseCb = ArenaCheck_InUse;
+
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        noise = noise * 1664525 + 1013904223;
+        const uint8_t h = 1 + (noise >> 8) % SAMPLE_ARENA_EXTENTS;
+        const uint32_t op = (noise >> 24) % 8;
+
+        if ((op < 3) && (sampleArena.ext[h].state != sample_extent_used))
+        {
+            /* lengths from a few samples up to a quarter of the arena */
+            const uint32_t n = 1 + (((noise >> 4) & 0xFFFF) * ((noise >> 20) & 0xFF)) % (ARENA_CHECK_LEN / 4);
+            const uint8_t a = SampleArena_Alloc(n);
+            if (a == SAMPLE_ARENA_NONE)
+            {
+                failed++;
+            }
+            else
+            {
+                SampleArena_Pin(a, true);
+                tag[a] = step;
+                len[a] = n;
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    SampleArena_Data(a)[i] = ArenaCheck_Value(tag[a], i);
+                }
+                SampleArena_Pin(a, false);
+                arenaCheckReader[a] = SampleArena_Data(a);
+            }
+        }
+        else if ((op == 3) && (sampleArena.ext[h].state == sample_extent_used) && (len[h] > 1))
+        {
+            len[h] /= 2;
+            SampleArena_Shrink(h, len[h]);
+        }
+        else if ((op == 4) && (sampleArena.ext[h].state == sample_extent_used))
+        {
+            /* the reader keeps the old data for a while */
+            SampleArena_Retire(h);
+            len[h] = 0;
+        }
+        else if (op == 5)
+        {
+            arenaCheckReader[h] = NULL;
+        }
+        else if ((op == 6) && (sampleArena.ext[h].state == sample_extent_used))
+        {
+            /* an extent which was never published */
+            arenaCheckReader[h] = NULL;
+            SampleArena_Free(h);
+            len[h] = 0;
+        }
+
+        seq++;
+        SampleArena_Service(&seq, 1 + (noise & 0x3FFF));
+        ArenaCheck_Invariants(step);
+
+        for (uint8_t e = 1; e <= SAMPLE_ARENA_EXTENTS; e++)
+        {
+            if ((sampleArena.ext[e].state == sample_extent_used) && (len[e] > 0))
+            {
+                const int16_t *data = SampleArena_Data(e);
+                for (uint32_t i = 0; i < len[e]; i += 1 + len[e] / 64)
+                {
+                    if (data[i] != ArenaCheck_Value(tag[e], i))
+                    {
+                        ArenaCheck_Error("content of an extent changed", step);
+                        break;
+                    }
+                }
+            }
+        }
+        for (uint8_t e = 1; e <= SAMPLE_ARENA_EXTENTS; e++)
+        {
+            if ((sampleArena.ext[e].state == sample_extent_free) && ArenaCheck_InUse(sampleArena.ext[e].data, sampleArena.ext[e].len))
+            {
+                ArenaCheck_Error("extent was freed while a reader used it", step);
+                break;
+            }
+        }
+    }
+
+    /* without new allocations the compaction goes on until no used extent fits into a free extent below it */
+    for (uint8_t e = 0; e <= SAMPLE_ARENA_EXTENTS; e++)
+    {
+        arenaCheckReader[e] = (sampleArena.ext[e].state == sample_extent_used) ? arenaCheckReader[e] : NULL;
+    }
+    uint32_t services = 0;
+    while (SampleArena_Service(&(++seq), ARENA_CHECK_LEN) && (services < 10000))
+    {
+        services++;
+    }
+    ArenaCheck_Invariants(steps);
+    bool compacted = true;
+    for (uint8_t f = sampleArena.first; f != SAMPLE_ARENA_NONE; f = sampleArena.ext[f].next)
+    {
+        for (uint8_t u = sampleArena.ext[f].next; (sampleArena.ext[f].state == sample_extent_free) && (u != SAMPLE_ARENA_NONE); u = sampleArena.ext[u].next)
+        {
+            compacted &= (sampleArena.ext[u].state != sample_extent_used) || (sampleArena.ext[u].len > sampleArena.ext[f].len);
+        }
+    }
+    if (!compacted)
+    {
+        ArenaCheck_Error("arena is not compacted", steps);
+    }
+
+    printf("random: %u steps, %u allocations failed, %u moves (%u samples), %u errors\n",
+           steps, failed, sampleArena.moves, sampleArena.movedSamples, errors);
+    /* the player creates its own arena */
+    memset(&sampleArena, 0, sizeof(sampleArena));
+    sampleArena_remapCb = NULL;
+    sampleArena_inUseCb = NULL;
+}
+
+/*
+ * renders a pattern of the synthetic kit, the notes are started by the rendering thread
+ */
+static void ArenaCheck_Render(float *out, std::atomic<bool> *running)
+{
+    float signal_l[SAMPLE_BUFFER_SIZE];
+    float signal_r[SAMPLE_BUFFER_SIZE];
+
+    playerStopAll();
+    for (int block = 0; block < ARENA_CHECK_RENDER; block++)
+    {
+        if ((block % 8) == 0)
+        {
+            playerNoteOn((block / 8) % 4, 0, 60, 1.0f, ((block / 32) % 5) * 100 - 200);
+        }
+        memset(signal_l, 0, sizeof(signal_l));
+        memset(signal_r, 0, sizeof(signal_r));
+        playerProcess(signal_l, signal_r, SAMPLE_BUFFER_SIZE);
+        memcpy(&out[block * SAMPLE_BUFFER_SIZE * 2], signal_l, sizeof(signal_l));
+        memcpy(&out[block * SAMPLE_BUFFER_SIZE * 2 + SAMPLE_BUFFER_SIZE], signal_r, sizeof(signal_r));
+        if (running != NULL)
+        {
+            /* gives the compaction time to run, the host renders faster than real time */
+            std::this_thread::yield();
+        }
+    }
+    if (running != NULL)
+    {
+        running->store(false);
+    }
+}
+
+void ArenaCheck_Concurrent(void)
+{
+    static float ref[ARENA_CHECK_RENDER * SAMPLE_BUFFER_SIZE * 2];
+    static float out[ARENA_CHECK_RENDER * SAMPLE_BUFFER_SIZE * 2];
+
+    playerInit();
+    playerArenaInit();
+
+    /* the first samples leave holes below the final ones, so all of them have to be moved */
+    for (int i = 0; i < 4; i++)
+    {
+        Host_LoadNoiseSample(i, SAMPLE_RATE / 2);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        Host_LoadSyntheticSample(i);
+    }
+
+    ArenaCheck_Render(ref, NULL);
+
+    /* the same again while the old samples are freed and the new ones are moved down */
+    uint64_t maxSlice = 0;
+    uint32_t services = 0;
+    std::atomic<bool> running(true);
+    std::thread audio(ArenaCheck_Render, out, &running);
+    while (running.load())
+    {
+        uint64_t t0 = ArenaCheck_Now();
+        bool busy = SampleArena_Service(&playerProcessSeq, SAMPLE_ARENA_SLICE);
+        uint64_t t1 = ArenaCheck_Now();
+        if (busy)
+        {
+            maxSlice = max(maxSlice, t1 - t0);
+            services++;
+        }
+        std::this_thread::yield();
+    }
+    audio.join();
+
+    if (memcmp(ref, out, sizeof(ref)) != 0)
+    {
+        ArenaCheck_Error("output differs when the arena is compacted", 0);
+    }
+    if (sampleArena.moves == 0)
+    {
+        ArenaCheck_Error("nothing was moved while rendering", 0);
+    }
+
+    /* deleting a record shifted all samples behind it */
+    const uint32_t used = sampleArena.len - SampleArena_FreeTotal();
+    uint64_t t0 = ArenaCheck_Now();
+    memmove(sampleArena.base, sampleArena.base + SAMPLE_RATE / 4, (used + SAMPLE_RATE / 4) * sizeof(int16_t));
+    uint64_t t1 = ArenaCheck_Now();
+
+    printf("concurrent: %u blocks, %u moves, %u busy services, longest service %.1f us, memmove of %u samples %.1f us\n",
+           ARENA_CHECK_RENDER, sampleArena.moves, services, maxSlice / 1000.0, used + SAMPLE_RATE / 4, (t1 - t0) / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t steps = 20000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            steps = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n steps]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Serial.enabled = false;
+
+    ArenaCheck_Random(steps);
+    ArenaCheck_Concurrent();
+
+    printf("%u errors\n", errors);
+    return (errors == 0) ? 0 : 1;
+}
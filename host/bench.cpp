@@ -0,0 +1,337 @@
+/*
+ * benchmark of the audio chain used by audio_task()
+ *
+ * each stage (sample players, reverb, float to int16 conversion) is timed separately
+ * while the number of loaded players, active voices and the buffer size are varied
+ *
+ * the result is written as json to allow tracking of regressions across commits
+ *
+ * usage: bench [-f frames] [-r repeats] [-e] [-c] [-o out.json]
+ *
+ * frames: number of samples rendered per configuration and repeat
+ * repeats: each configuration is repeated, the fastest run is reported
+ * -e: the voices are held notes with an envelope and a loop (sampler) instead of one shots
+ * -c: the cache misses of the player stage are counted with the perf events of linux in an extra
+ *     run (not timed), they are reported per block, null when the counters are not available
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <chrono>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include "audio_task.h"
+
+#include "host_util.h"
+
+/* bench samples must be longer than the rendered frames to keep the voices active */
+#define BENCH_SAMPLE_LEN    (2 * SAMPLE_RATE)
+
+enum benchStage
+{
+    stage_player,
+    stage_reverb,
+    stage_convert,
+    stage_count,
+};
+
+const char *stageNames[stage_count] = {"player", "reverb", "convert"};
+
+struct bench_result_s
+{
+    int players;
+    int voices;
+    int buffLen;
+    double nsPerSample[stage_count];
+    double total;
+};
+
+static inline uint64_t Bench_Now(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool benchEnvelope = false;
+
+enum benchCounter
+{
+    counter_l1d, /* level 1 data cache read misses */
+    counter_llc, /* last level cache misses */
+    counter_count,
+};
+
+const char *counterNames[counter_count] = {"l1d", "llc"};
+
+/* file descriptors of the perf events, -1: not counted */
+int benchCounterFd[counter_count] = {-1, -1};
+
+/*
+ * opens the counters of the player stage, returns false when the kernel or the cpu does not provide them
+ */
+bool Bench_OpenCounters(void)
+{
+    const uint64_t configs[counter_count] =
+    {
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+    const uint32_t types[counter_count] = {PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+
+    for (int c = 0; c < counter_count; c++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[c];
+        attr.config = configs[c];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        benchCounterFd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (benchCounterFd[c] < 0)
+        {
+            fprintf(stderr, "perf counter %s not available: %s\n", counterNames[c], strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * counts the events of the player stage while the chain is rendered, returns the counts per block
+ */
+void Bench_Count(int buffLen, uint32_t frames, double *perBlock)
+{
+    uint64_t count[counter_count];
+    uint32_t blocks = 0;
+
+    for (int c = 0; c < counter_count; c++)
+    {
+        ioctl(benchCounterFd[c], PERF_EVENT_IOC_RESET, 0);
+    }
+    for (uint32_t frame = 0; frame < frames; frame += buffLen)
+    {
+        for (int c = 0; c < counter_count; c++)
+        {
+            ioctl(benchCounterFd[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+        audio_render_players(buffLen);
+        for (int c = 0; c < counter_count; c++)
+        {
+            ioctl(benchCounterFd[c], PERF_EVENT_IOC_DISABLE, 0);
+        }
+        audio_render_effects(buffLen);
+        audio_output(buffLen);
+        blocks++;
+    }
+    for (int c = 0; c < counter_count; c++)
+    {
+        if (read(benchCounterFd[c], &count[c], sizeof(count[c])) != sizeof(count[c]))
+        {
+            count[c] = 0;
+        }
+        perBlock[c] = ((double)count[c]) / blocks;
+    }
+}
+
+/* slow attack and decay, the voices stay in the ramped part of the envelope */
+const struct player_env_s benchEnv = {true, 1.0f / SAMPLE_RATE, 0.99999f, 0.5f, 0.9999f};
+
+/*
+ * starts the voices of a configuration
+ */
+void Bench_Start(int players, int voices)
+{
+    playerStopAll();
+    sampleCount = players;
+    for (int i = 0; i < voices; i++)
+    {
+        if (benchEnvelope)
+        {
+            playerSetEnvelope(i, &benchEnv);
+            playerSetLoop(i, 0, BENCH_SAMPLE_LEN);
+            playerNoteOn(i, 0, i, 1.0f, 0);
+        }
+        else
+        {
+            playerSampleOn(i);
+        }
+    }
+}
+
+/*
+ * renders the chain of audio_task() stage by stage and returns the time per stage in ns
+ */
+void Bench_Run(int players, int voices, int buffLen, uint32_t frames, uint64_t *stageTime)
+{
+    Bench_Start(players, voices);
+
+    for (int s = 0; s < stage_count; s++)
+    {
+        stageTime[s] = 0;
+    }
+
+    for (uint32_t frame = 0; frame < frames; frame += buffLen)
+    {
+        uint64_t t0 = Bench_Now();
+        audio_render_players(buffLen);
+        uint64_t t1 = Bench_Now();
+        audio_render_effects(buffLen);
+        uint64_t t2 = Bench_Now();
+        audio_output(buffLen);
+        uint64_t t3 = Bench_Now();
+
+        stageTime[stage_player] += t1 - t0;
+        stageTime[stage_reverb] += t2 - t1;
+        stageTime[stage_convert] += t3 - t2;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t frames = 32768;
+    int repeats = 5;
+    FILE *out = stdout;
+    bool counters = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:r:eco:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            frames = atoi(optarg);
+            break;
+        case 'r':
+            repeats = max(1, atoi(optarg));
+            break;
+        case 'e':
+            benchEnvelope = true;
+            break;
+        case 'c':
+            counters = true;
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL)
+            {
+                fprintf(stderr, "could not create %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f frames] [-r repeats] [-e] [-c] [-o out.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (frames > BENCH_SAMPLE_LEN)
+    {
+        frames = BENCH_SAMPLE_LEN;
+    }
+
+    const bool countersOpen = counters && Bench_OpenCounters();
+
+    Serial.enabled = false;
+
+    playerInit();
+    static float *revBuffer = (float *)malloc(sizeof(float) * REV_BUFF_SIZE);
+    Reverb_Setup(revBuffer);
+    Reverb_SetLevel(0, 0.2f);
+
+    for (int i = 0; i < NUM_PLAYERS; i++)
+    {
+        Host_LoadNoiseSample(i, BENCH_SAMPLE_LEN);
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"sample_rate\": %d,\n", SAMPLE_RATE);
+#ifdef PLAYER_FIXED_POINT
+    fprintf(out, "  \"mix\": \"fixed\",\n");
+#else
+    fprintf(out, "  \"mix\": \"float\",\n");
+#endif
+    fprintf(out, "  \"voice_mode\": \"%s\",\n", benchEnvelope ? "envelope" : "one_shot");
+    fprintf(out, "  \"num_players\": %d,\n", NUM_PLAYERS);
+    fprintf(out, "  \"sample_buffer_size\": %d,\n", SAMPLE_BUFFER_SIZE);
+    fprintf(out, "  \"frames\": %u,\n", frames);
+    fprintf(out, "  \"repeats\": %d,\n", repeats);
+    fprintf(out, "  \"results\": [");
+
+    bool first = true;
+    for (int players = 1; players <= NUM_PLAYERS; players *= 2)
+    {
+        int voiceSteps[] = {0, 1, players / 2, players};
+        int lastVoices = -1;
+        for (int v = 0; v < 4; v++)
+        {
+            int voices = voiceSteps[v];
+            if (voices <= lastVoices)
+            {
+                continue;
+            }
+            lastVoices = voices;
+
+            for (int buffLen = 16; buffLen <= SAMPLE_BUFFER_SIZE; buffLen *= 2)
+            {
+                struct bench_result_s result = {players, voices, buffLen, {0}, 0};
+                uint64_t best[stage_count];
+
+                for (int r = 0; r < repeats; r++)
+                {
+                    uint64_t stageTime[stage_count];
+                    Bench_Run(players, voices, buffLen, frames, stageTime);
+                    for (int s = 0; s < stage_count; s++)
+                    {
+                        if ((r == 0) || (stageTime[s] < best[s]))
+                        {
+                            best[s] = stageTime[s];
+                        }
+                    }
+                }
+
+                uint32_t rendered = ((frames + buffLen - 1) / buffLen) * buffLen;
+                for (int s = 0; s < stage_count; s++)
+                {
+                    result.nsPerSample[s] = ((double)best[s]) / rendered;
+                    result.total += result.nsPerSample[s];
+                }
+
+                /* real time factor: how many times faster than required at SAMPLE_RATE */
+                double rtf = (1e9 / SAMPLE_RATE) / result.total;
+
+                fprintf(out, "%s\n    {\"players\": %d, \"voices\": %d, \"buffer\": %d, \"ns_per_sample\": {",
+                        first ? "" : ",", result.players, result.voices, result.buffLen);
+                for (int s = 0; s < stage_count; s++)
+                {
+                    fprintf(out, "\"%s\": %.3f, ", stageNames[s], result.nsPerSample[s]);
+                }
+                fprintf(out, "\"total\": %.3f}, \"realtime_factor\": %.2f", result.total, rtf);
+                if (countersOpen)
+                {
+                    double perBlock[counter_count];
+                    Bench_Start(players, voices);
+                    Bench_Count(buffLen, frames, perBlock);
+                    fprintf(out, ", \"player_misses_per_block\": {\"%s\": %.2f, \"%s\": %.2f}",
+                            counterNames[counter_l1d], perBlock[counter_l1d], counterNames[counter_llc], perBlock[counter_llc]);
+                }
+                else if (counters)
+                {
+                    fprintf(out, ", \"player_misses_per_block\": null");
+                }
+                fprintf(out, "}");
+                first = false;
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * stress test of the command queue from the ui/sequencer core to the audio core
+ *
+ * a producer thread and a consumer thread run concurrently:
+ * - queue: raw commands with a sequence number, the consumer checks order and content
+ * - audio: pan/vol/trigger commands while the audio task renders, the final state is checked
+ *   (count / 100 commands, the triggers are mostly late because the host renders faster than real time)
+ *
+ * usage: cmd_stress [-n commands]
+ *
+ * returns 1 when a command was lost, reordered or torn
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+
+#include "config.h"
+#include "audio_task.h"
+
+#include "host_util.h"
+
+/*
+ * fills a command with values derived from its sequence number, to detect torn commands
+ */
+static void Stress_MakeCmd(uint32_t seq, struct audio_cmd_s *cmd)
+{
+    cmd->frame = seq;
+    cmd->type = audio_cmd_set_pan;
+    cmd->index = seq & 0xFF;
+    cmd->value = (seq * 7) & 0xFF;
+    cmd->level = seq;
+}
+
+uint32_t Stress_Queue(uint32_t count)
+{
+    static struct audio_cmd_queue_s queue;
+    uint32_t errors = 0;
+
+    std::thread producer([&]()
+    {
+        for (uint32_t seq = 0; seq < count; seq++)
+        {
+            struct audio_cmd_s cmd;
+            Stress_MakeCmd(seq, &cmd);
+            while (!AudioCmd_Push(&queue, &cmd))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    for (uint32_t seq = 0; seq < count;)
+    {
+        struct audio_cmd_s *cmd = AudioCmd_Peek(&queue);
+        if (cmd == NULL)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        struct audio_cmd_s expected;
+        Stress_MakeCmd(seq, &expected);
+        if ((cmd->frame != expected.frame) || (cmd->index != expected.index) || (cmd->value != expected.value) || (cmd->level != expected.level))
+        {
+            errors++;
+        }
+        AudioCmd_Pop(&queue);
+        seq++;
+    }
+
+    producer.join();
+    printf("queue: %u commands, %u errors, %u times full\n", count, errors, queue.dropped);
+    return errors;
+}
+
+uint32_t Stress_Audio(uint32_t count)
+{
+    uint32_t errors = 0;
+    std::atomic<bool> done(false);
+
+    std::thread producer([&]()
+    {
+        for (uint32_t seq = 0; seq < count; seq++)
+        {
+            uint8_t sampleNum = seq % NUM_PLAYERS;
+            while (!AudioCmd_SetPan(sampleNum, seq % 19))
+            {
+                std::this_thread::yield();
+            }
+            while (!AudioCmd_SetVol(sampleNum, seq % 16))
+            {
+                std::this_thread::yield();
+            }
+            while (!AudioCmd_SampleOn(sampleNum, AudioCmd_FrameNow()))
+            {
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+    });
+
+    while (!done || (AudioCmd_Peek(&audioCmdQueue) != NULL))
+    {
+        audio_task();
+    }
+    producer.join();
+
+    /* the last command per sample must have been applied */
+    for (uint32_t seq = (count > NUM_PLAYERS) ? (count - NUM_PLAYERS) : 0; seq < count; seq++)
+    {
+        struct sample_player *player = &samplePlayers[seq % NUM_PLAYERS];
+        if ((player->pan != seq % 19) || (player->velocity != (float)(seq % 16) / 16))
+        {
+            errors++;
+        }
+    }
+    printf("audio: %u x 3 commands, %u errors, %u rendered frames, %u late triggers\n", count, errors, audioFrame, audioCmdLate);
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            count = max(1, atoi(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n commands]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Serial.enabled = false;
+
+    playerInit();
+    static float *revBuffer = (float *)malloc(sizeof(float) * REV_BUFF_SIZE);
+    Reverb_Setup(revBuffer);
+    Reverb_SetLevel(0, 0.2f);
+    for (int i = 0; i < NUM_PLAYERS; i++)
+    {
+        Host_LoadSyntheticSample(i);
+    }
+
+    uint32_t errors = Stress_Queue(count);
+    errors += Stress_Audio(max(count / 100, (uint32_t)NUM_PLAYERS));
+
+    return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/*
+ * checks the compile time table of euclid.h against the runtime Bjorklund implementation it replaced
+ *
+ * all lengths 1..16, pulses 1..length and offsets 0..length-1 are compared,
+ * patterns without pulses must be empty (the old function divided by zero for them)
+ *
+ * the old function only supported 16 steps, for the lengths up to 64 the number of
+ * pulses and the spacing (gaps between pulses differ by at most one step) are checked
+ *
+ * usage: euclid_check
+ *
+ * returns 1 when a pattern differs
+ */
+#include <Arduino.h>
+
+#include "euclid.h"
+
+/* the table is calculated by the compiler */
+static_assert(euclidTable.pattern[EUCLID_TABLE_INDEX(16, 4)] == 0x8888, "E(4,16)");
+static_assert(euclidTable.pattern[EUCLID_TABLE_INDEX(8, 8)] == 0xFF, "E(8,8)");
+static_assert(euclidTable.pattern[EUCLID_TABLE_INDEX(64, 64)] == ~0ULL, "E(64,64)");
+
+/*
+ * the previous implementation, kept as reference
+ * the only change: findlength started at bit 32 of an unsigned int, that shift is undefined
+ * (on x86 it reads bit 0 and breaks all patterns with more pulses than pauses)
+ */
+//------------Function to right rotate n by d bits---------------------------------//
+uint16_t refRightRotate(int shift, uint16_t value, uint8_t pattern_length) {
+  uint16_t mask = ((1 << pattern_length) - 1);
+  value &= mask;
+  return ((value >> shift) | (value << (pattern_length - shift))) & mask;
+}
+
+//----1---------Function to find the binary length of a number by counting bitwise-------//
+int refFindlength(unsigned int bnry) {
+  bool lengthfound = false;
+  int length = 1; // no number can have a length of zero - single 0 has a length of one, but no 1s for the sytem to count
+  for (int q = 31; q >= 0; q--) {
+    int r = bitRead(bnry, q);
+    if (r == 1 && lengthfound == false) {
+      length = q + 1;
+      lengthfound = true;
+    }
+  }
+  return length;
+}
+
+//-----2--------Function to concatenate two binary numbers bitwise----------------------//
+unsigned int refConcatBin(unsigned int bina, unsigned int binb) {
+  int binb_len = refFindlength(binb);
+  unsigned int sum = (bina << binb_len);
+  sum = sum | binb;
+  return sum;
+}
+
+//------3-------------------Euclidean bit sorting funciton-------------------------------//
+unsigned int euclidReference(int n, int k, int o) { // inputs: n=total, k=beats, o = offset
+  int pauses = n - k;
+  int pulses = k;
+  int offset = o;
+  int steps = n;
+  int per_pulse = pauses / k;
+  int remainder = pauses % pulses;
+  unsigned int workbeat[n];
+  unsigned int outbeat;
+  uint16_t outbeat2;
+  int workbeat_count = n;
+  int a;
+  int b;
+  int trim_count;
+
+  for (a = 0; a < n; a++) { // Populate workbeat with unsorted pulses and pauses
+    if (a < pulses) {
+      workbeat[a] = 1;
+    }
+    else {
+      workbeat[a] = 0;
+    }
+  }
+
+  if (per_pulse > 0 && remainder < 2) { // Handle easy cases where there is no or only one remainer
+    for (a = 0; a < pulses; a++) {
+      for (b = workbeat_count - 1; b > workbeat_count - per_pulse - 1; b--) {
+        workbeat[a] = refConcatBin(workbeat[a], workbeat[b]);
+      }
+      workbeat_count = workbeat_count - per_pulse;
+    }
+
+    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count
+    for (a = 0; a < workbeat_count; a++) {
+      outbeat = refConcatBin(outbeat, workbeat[a]);
+    }
+
+    if (offset > 0) {
+      outbeat2 = refRightRotate(offset, outbeat, steps); // Add offset to the step pattern
+    }
+    else {
+      outbeat2 = outbeat;
+    }
+
+    return outbeat2;
+  }
+
+  else {
+    if (pulses == 0) {
+      pulses = 1;  // Prevent crashes when k=0 and n goes from 0 to 1
+    }
+    int groupa = pulses;
+    int groupb = pauses;
+    int iteration = 0;
+    if (groupb <= 1) {
+    }
+
+    while (groupb > 1) { //main recursive loop
+      
+      if (groupa > groupb) { // more Group A than Group B
+        int a_remainder = groupa - groupb; // what will be left of groupa once groupB is interleaved
+        trim_count = 0;
+        for (a = 0; a < groupa - a_remainder; a++) { //count through the matching sets of A, ignoring remaindered
+          workbeat[a] = refConcatBin(workbeat[a], workbeat[workbeat_count - 1 - a]);
+          trim_count++;
+        }
+        workbeat_count = workbeat_count - trim_count;
+
+        groupa = groupb;
+        groupb = a_remainder;
+      }
+
+      else if (groupb > groupa) { // More Group B than Group A
+        int b_remainder = groupb - groupa; // what will be left of group once group A is interleaved
+        trim_count = 0;
+        for (a = workbeat_count - 1; a >= groupa + b_remainder; a--) { //count from right back through the Bs
+          workbeat[workbeat_count - a - 1] = refConcatBin(workbeat[workbeat_count - a - 1], workbeat[a]);
+
+          trim_count++;
+        }
+        workbeat_count = workbeat_count - trim_count;
+        groupb = b_remainder;
+      }
+
+      else if (groupa == groupb) { // groupa = groupb
+        trim_count = 0;
+        for (a = 0; a < groupa; a++) {
+          workbeat[a] = refConcatBin(workbeat[a], workbeat[workbeat_count - 1 - a]);
+          trim_count++;
+        }
+        workbeat_count = workbeat_count - trim_count;
+        groupb = 0;
+      }
+
+      else {
+        //Serial.println("ERROR");
+      }
+      iteration++;
+    }
+
+    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count
+    for (a = 0; a < workbeat_count; a++) {
+      outbeat = refConcatBin(outbeat, workbeat[a]);
+    }
+
+    if (offset > 0) {
+      outbeat2 = refRightRotate(offset, outbeat, steps); // Add offset to the step pattern
+    }
+    else {
+      outbeat2 = outbeat;
+    }
+
+    return outbeat2;
+  }
+}
+
+/*
+ * a euclidean pattern has k pulses and the gaps between them differ by at most one step
+ */
+bool Euclid_Valid(uint64_t pattern, int n, int k)
+{
+    int count = 0;
+    int first = -1, last = -1;
+    int minGap = n, maxGap = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((pattern >> i) & 1)
+        {
+            if (last >= 0)
+            {
+                minGap = min(minGap, i - last);
+                maxGap = max(maxGap, i - last);
+            }
+            else
+            {
+                first = i;
+            }
+            last = i;
+            count++;
+        }
+    }
+    if ((n < 64) && (pattern >> n))
+    {
+        return false;
+    }
+    if (count > 1)
+    {
+        /* the gap across the end of the loop */
+        minGap = min(minGap, n - last + first);
+        maxGap = max(maxGap, n - last + first);
+    }
+    return (count == k) && ((count <= 1) || (maxGap - minGap <= 1));
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t checked = 0;
+    uint32_t errors = 0;
+
+    for (int n = 1; n <= 16; n++)
+    {
+        if (euclid(n, 0, 0) != 0)
+        {
+            printf("E(0,%d) is not empty\n", n);
+            errors++;
+        }
+        for (int k = 1; k <= n; k++)
+        {
+            for (int o = 0; o < n; o++)
+            {
+                uint16_t expected = euclidReference(n, k, o);
+                uint16_t pattern = euclid(n, k, o);
+                if (pattern != expected)
+                {
+                    printf("E(%d,%d) offset %d: 0x%04x expected 0x%04x\n", k, n, o, pattern, expected);
+                    errors++;
+                }
+                checked++;
+            }
+        }
+    }
+
+    for (int n = 1; n <= EUCLID_MAX_STEPS; n++)
+    {
+        for (int k = 0; k <= n; k++)
+        {
+            for (int o = 0; o < n; o++)
+            {
+                uint64_t pattern = euclid(n, k, o);
+                if (!Euclid_Valid(pattern, n, k))
+                {
+                    printf("E(%d,%d) offset %d: 0x%016llx is not euclidean\n", k, n, o, (unsigned long long)pattern);
+                    errors++;
+                }
+                checked++;
+            }
+        }
+    }
+
+    printf("%u patterns checked, %u errors\n", checked, errors);
+    return (errors == 0) ? 0 : 1;
+}
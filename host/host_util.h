@@ -0,0 +1,175 @@
+/*
+ * helpers shared by the host tools
+ * - a synthetic drum kit, so the tools do not depend on sample files
+ * - a simple 16 bit stereo wav writer which can be used as i2s sink
+ *
+ * include this after player.h
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <driver/i2s.h>
+
+/*
+ * the synthetic kit, one sound per player slot (kick, snare, hat, tom)
+ * a fixed noise seed is used so every render produces identical output
+ */
+void Host_LoadSyntheticSample(uint8_t sampleNum)
+{
+    uint32_t numSamples;
+    uint32_t noise = 0x12345678 + sampleNum;
+
+    switch (sampleNum % 4)
+    {
+    case 0:
+        numSamples = SAMPLE_RATE / 2;
+        break;
+    case 1:
+        numSamples = SAMPLE_RATE / 4;
+        break;
+    case 2:
+        numSamples = SAMPLE_RATE / 16;
+        break;
+    default:
+        numSamples = SAMPLE_RATE / 3;
+        break;
+    }
+
+    int16_t *data = playerSampleAlloc(sampleNum, numSamples);
+    if (data == NULL)
+    {
+        Serial.printf("Could not allocate psram!\n");
+        return;
+    }
+
+    float phase = 0.0f;
+    for (uint32_t n = 0; n < numSamples; n++)
+    {
+        float t = ((float)n) / SAMPLE_RATE;
+        noise = noise * 1664525 + 1013904223;
+        float white = ((float)(int32_t)noise) / 2147483648.0f;
+        float sample;
+
+        switch (sampleNum % 4)
+        {
+        case 0: /* kick: sine sweep with exponential decay */
+            phase += 2.0f * M_PI * (50.0f + 120.0f * expf(-t * 40.0f)) / SAMPLE_RATE;
+            sample = sinf(phase) * expf(-t * 8.0f);
+            break;
+        case 1: /* snare: tone and noise */
+            phase += 2.0f * M_PI * 180.0f / SAMPLE_RATE;
+            sample = 0.5f * sinf(phase) * expf(-t * 30.0f) + 0.5f * white * expf(-t * 15.0f);
+            break;
+        case 2: /* hat: short noise burst */
+            sample = white * expf(-t * 60.0f);
+            break;
+        default: /* tom: sine with short decay */
+            phase += 2.0f * M_PI * (110.0f + 40.0f * expf(-t * 20.0f)) / SAMPLE_RATE;
+            sample = sinf(phase) * expf(-t * 10.0f);
+            break;
+        }
+        data[n] = (int16_t)(sample * 20000.0f);
+    }
+
+    playerSetSample(sampleNum, data, numSamples);
+}
+
+/*
+ * a single impulse followed by silence, used to measure trigger timing
+ */
+void Host_LoadClickSample(uint8_t sampleNum)
+{
+    const uint32_t numSamples = 32;
+
+    int16_t *data = playerSampleAlloc(sampleNum, numSamples);
+    if (data == NULL)
+    {
+        Serial.printf("Could not allocate psram!\n");
+        return;
+    }
+    memset(data, 0, numSamples * sizeof(int16_t));
+    data[0] = 0x7000;
+
+    playerSetSample(sampleNum, data, numSamples);
+}
+
+/*
+ * full scale noise with a given length, used to keep voices busy for benchmarks
+ */
+void Host_LoadNoiseSample(uint8_t sampleNum, uint32_t numSamples)
+{
+    uint32_t noise = 0x87654321 + sampleNum;
+
+    int16_t *data = playerSampleAlloc(sampleNum, numSamples);
+    if (data == NULL)
+    {
+        Serial.printf("Could not allocate psram!\n");
+        return;
+    }
+
+    for (uint32_t n = 0; n < numSamples; n++)
+    {
+        noise = noise * 1664525 + 1013904223;
+        data[n] = (int16_t)(noise >> 16);
+    }
+
+    playerSetSample(sampleNum, data, numSamples);
+}
+
+/*
+ * wav writer, header is written when the file is closed
+ */
+struct host_wav_s
+{
+    FILE *fp;
+    uint32_t dataSize;
+};
+
+bool Host_WavOpen(struct host_wav_s *wav, const char *filename)
+{
+    wav->fp = fopen(filename, "wb");
+    wav->dataSize = 0;
+    if (wav->fp == NULL)
+    {
+        return false;
+    }
+    uint8_t header[44] = {0};
+    fwrite(header, 1, sizeof(header), wav->fp);
+    return true;
+}
+
+void Host_WavWrite(const void *src, size_t size, void *user)
+{
+    struct host_wav_s *wav = (struct host_wav_s *)user;
+    wav->dataSize += fwrite(src, 1, size, wav->fp);
+}
+
+void Host_WavClose(struct host_wav_s *wav)
+{
+    uint32_t u32;
+    uint16_t u16;
+
+    fseek(wav->fp, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, wav->fp);
+    u32 = 36 + wav->dataSize;
+    fwrite(&u32, 4, 1, wav->fp);
+    fwrite("WAVEfmt ", 1, 8, wav->fp);
+    u32 = 16; /* length of the fmt header */
+    fwrite(&u32, 4, 1, wav->fp);
+    u16 = 1; /* PCM */
+    fwrite(&u16, 2, 1, wav->fp);
+    u16 = CHANNEL_COUNT;
+    fwrite(&u16, 2, 1, wav->fp);
+    u32 = SAMPLE_RATE;
+    fwrite(&u32, 4, 1, wav->fp);
+    u32 = SAMPLE_RATE * CHANNEL_COUNT * sizeof(int16_t);
+    fwrite(&u32, 4, 1, wav->fp);
+    u16 = CHANNEL_COUNT * sizeof(int16_t);
+    fwrite(&u16, 2, 1, wav->fp);
+    u16 = WORD_SIZE;
+    fwrite(&u16, 2, 1, wav->fp);
+    fwrite("data", 1, 4, wav->fp);
+    fwrite(&wav->dataSize, 4, 1, wav->fp);
+    fclose(wav->fp);
+    wav->fp = NULL;
+}
@@ -0,0 +1,194 @@
+/*
+ * benchmark of the interpolation kernels of the pitched voices
+ *
+ * every kernel (none: integer steps, linear, cubic hermite) resamples a resident sample
+ * with the loop of playerResample at several pitches, the time per frame and the
+ * signal to noise ratio of a resampled sine (against the exact sine) are reported
+ *
+ * the result is written as json like the benchmark of the audio chain
+ *
+ * usage: interp_bench [-f frames] [-r repeats] [-o out.json]
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "config.h"
+#include "audio_task.h"
+
+#include "host_util.h"
+
+#define INTERP_BENCH_SOURCE_LEN (PLAYER_RATE_MAX * SAMPLE_RATE + 4)
+
+static inline float InterpBench_None(const int16_t *x, uint32_t frac)
+{
+    return x[1];
+}
+
+/* names of the kernels run by InterpBench_Run */
+const char *interpKernelNames[] = {"none", "linear", "cubic"};
+
+/* cents of the benchmarked pitches, 0 is resampled too to show the cost of the kernel */
+const int interpPitches[] = {-1200, -100, 0, 50, 700, 1200, 2400};
+
+static inline uint64_t InterpBench_Now(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * same loop as playerResample, the source is resident so the gather is left out
+ */
+template <float (*Kernel)(const int16_t *x, uint32_t frac)>
+static void InterpBench_Resample(const int16_t *src, uint64_t rate, float *out, int frames)
+{
+    uint64_t phase = 0;
+    for (int n = 0; n < frames; n += PLAYER_RESAMPLE_CHUNK)
+    {
+        const int len = min(frames - n, PLAYER_RESAMPLE_CHUNK);
+        const int16_t *x = &src[phase >> 32];
+        uint64_t p = (uint32_t)phase;
+        for (int k = 0; k < len; k++)
+        {
+            out[n + k] = Kernel(&x[p >> 32], (uint32_t)p);
+            p += rate;
+        }
+        phase += len * rate;
+    }
+}
+
+static void InterpBench_Run(int kernel, const int16_t *src, uint64_t rate, float *out, int frames)
+{
+    switch (kernel)
+    {
+    case 0:
+        InterpBench_Resample<InterpBench_None>(src, rate, out, frames);
+        break;
+    case 1:
+        InterpBench_Resample<playerInterpolateLinear>(src, rate, out, frames);
+        break;
+    default:
+        InterpBench_Resample<playerInterpolateCubic>(src, rate, out, frames);
+        break;
+    }
+}
+
+/*
+ * signal to noise ratio in dB of a resampled sine, src[1 + n] is the sine at frame n
+ */
+static double InterpBench_Snr(const float *out, int frames, double freq, double ratio)
+{
+    double signal = 0.0;
+    double noise = 0.0;
+    for (int n = 4; n < frames; n++)
+    {
+        double exact = 16384.0 * sin(2.0 * M_PI * freq * ratio * n / SAMPLE_RATE);
+        signal += exact * exact;
+        noise += (out[n] - exact) * (out[n] - exact);
+    }
+    return (noise > 0.0) ? 10.0 * log10(signal / noise) : 999.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = 32768;
+    int repeats = 5;
+    FILE *out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:r:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            frames = constrain(atoi(optarg), PLAYER_RESAMPLE_CHUNK, SAMPLE_RATE);
+            break;
+        case 'r':
+            repeats = max(1, atoi(optarg));
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL)
+            {
+                fprintf(stderr, "could not create %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f frames] [-r repeats] [-o out.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Serial.enabled = false;
+
+    /* noise for the timing, two sines for the quality */
+    static int16_t noise[INTERP_BENCH_SOURCE_LEN];
+    static int16_t sineLow[INTERP_BENCH_SOURCE_LEN];
+    static int16_t sineHigh[INTERP_BENCH_SOURCE_LEN];
+    static float result[SAMPLE_RATE];
+    const double freqLow = 997.0;
+    const double freqHigh = 5003.0;
+    uint32_t seed = 0x12345678;
+    for (int n = 0; n < INTERP_BENCH_SOURCE_LEN; n++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        noise[n] = (int16_t)(seed >> 16);
+        sineLow[n] = (int16_t)lrint(16384.0 * sin(2.0 * M_PI * freqLow * (n - 1) / SAMPLE_RATE));
+        sineHigh[n] = (int16_t)lrint(16384.0 * sin(2.0 * M_PI * freqHigh * (n - 1) / SAMPLE_RATE));
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"sample_rate\": %d,\n", SAMPLE_RATE);
+#ifdef PLAYER_INTERPOLATION_LINEAR
+    fprintf(out, "  \"player_kernel\": \"linear\",\n");
+#else
+    fprintf(out, "  \"player_kernel\": \"cubic\",\n");
+#endif
+    fprintf(out, "  \"frames\": %d,\n", frames);
+    fprintf(out, "  \"repeats\": %d,\n", repeats);
+    fprintf(out, "  \"results\": [");
+
+    bool first = true;
+    for (size_t k = 0; k < sizeof(interpKernelNames) / sizeof(interpKernelNames[0]); k++)
+    {
+        for (size_t p = 0; p < sizeof(interpPitches) / sizeof(interpPitches[0]); p++)
+        {
+            const int cents = interpPitches[p];
+            const double ratio = pow(2.0, cents / 1200.0);
+            const uint64_t rate = playerPitchRate(cents);
+            uint64_t best = 0;
+
+            for (int r = 0; r < repeats; r++)
+            {
+                uint64_t t0 = InterpBench_Now();
+                InterpBench_Run(k, noise, rate, result, frames);
+                uint64_t t1 = InterpBench_Now();
+                if ((r == 0) || (t1 - t0 < best))
+                {
+                    best = t1 - t0;
+                }
+            }
+            /* keeps the timed loop from being removed */
+            volatile float sink = result[frames - 1];
+            (void)sink;
+
+            InterpBench_Run(k, sineLow, rate, result, frames);
+            double snrLow = InterpBench_Snr(result, frames, freqLow, ratio);
+            InterpBench_Run(k, sineHigh, rate, result, frames);
+            double snrHigh = InterpBench_Snr(result, frames, freqHigh, ratio);
+
+            fprintf(out, "%s\n    {\"kernel\": \"%s\", \"cents\": %d, \"ns_per_frame\": %.3f, \"snr_db\": {\"%.0f\": %.1f, \"%.0f\": %.1f}}",
+                    first ? "" : ",", interpKernelNames[k], cents, ((double)best) / frames, freqLow, snrLow, freqHigh, snrHigh);
+            first = false;
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * checks the MIDI clock follower with jittered pulse streams
+ *
+ * pulses of a known tempo get a constant latency and random jitter added,
+ * the steps (every SEQ_MIDI_PULSES_PER_TICK pulses) are scheduled from the filtered pulse times
+ * and compared with the ideal step times
+ *
+ * the error is measured after the PLL had time to lock (lockSeconds)
+ *
+ * usage: midi_clock [-s seed]
+ *
+ * returns 1 when a case exceeds its error bounds
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "config.h"
+#include "audio_task.h"
+#include "sequencer.h"
+
+struct clock_case_s
+{
+    const char *name;
+    float bpmStart;
+    float bpmEnd; /* linear tempo ramp over the duration */
+    float jitterUs; /* uniform jitter +-jitterUs */
+    float latencyUs; /* constant delay of the pulses */
+    float seconds;
+    float lockSeconds;
+    float maxStepErrorUs; /* bound for the scheduled steps */
+    float maxBpmError; /* bound for the measured tempo in bpm */
+};
+
+const struct clock_case_s clockCases[] =
+{
+    {"steady 120", 120.0f, 120.0f, 1000.0f, 500.0f, 60.0f, 3.0f, 550.0f, 0.2f},
+    {"steady 174", 174.0f, 174.0f, 2000.0f, 1500.0f, 60.0f, 3.0f, 1200.0f, 0.8f},
+    {"clean 90", 90.0f, 90.0f, 0.0f, 0.0f, 30.0f, 1.0f, 23.0f, 0.01f},
+    {"ramp 100..140", 100.0f, 140.0f, 500.0f, 300.0f, 60.0f, 3.0f, 900.0f, 0.5f},
+};
+
+uint32_t clockSeed = 1;
+
+static float Clock_Random(void)
+{
+    clockSeed = clockSeed * 1664525 + 1013904223;
+    return ((float)(clockSeed >> 8) / (float)(1 << 24)) * 2.0f - 1.0f;
+}
+
+bool Clock_Run(const struct clock_case_s *c)
+{
+    struct clock_follower_s cf;
+    ClockFollower_Reset(&cf);
+
+    double t = 0.0; /* ideal time of the pulse in s */
+    double rawMax = 0.0, stepMax = 0.0, stepSum = 0.0;
+    double bpmErrorMax = 0.0;
+    uint32_t steps = 0;
+
+    for (uint32_t pulse = 0; t < c->seconds; pulse++)
+    {
+        double bpm = c->bpmStart + (c->bpmEnd - c->bpmStart) * t / c->seconds;
+        double ideal = t * SAMPLE_RATE;
+        double measured = ideal + (c->latencyUs + c->jitterUs * Clock_Random()) * SAMPLE_RATE / 1000000.0;
+
+        uint32_t filtered = ClockFollower_Pulse(&cf, (uint32_t)measured);
+
+        if (t >= c->lockSeconds)
+        {
+            /* the constant latency can not be seen by the follower, it is part of the reference */
+            double reference = ideal + c->latencyUs * SAMPLE_RATE / 1000000.0;
+            rawMax = max(rawMax, fabs((uint32_t)measured - reference));
+            if ((pulse % SEQ_MIDI_PULSES_PER_TICK) == 0)
+            {
+                double error = fabs(filtered - reference);
+                stepMax = max(stepMax, error);
+                stepSum += error;
+                steps++;
+            }
+            bpmErrorMax = max(bpmErrorMax, fabs(ClockFollower_Bpm(&cf) - bpm));
+        }
+
+        t += 60.0 / (bpm * CLOCK_FOLLOWER_PPQN);
+    }
+
+    double toUs = 1000000.0 / SAMPLE_RATE;
+    bool ok = (stepMax * toUs <= c->maxStepErrorUs) && (bpmErrorMax <= c->maxBpmError);
+    printf("%-14s pulses err max %7.1f us, steps err avg %6.1f us max %6.1f us (<= %.0f), bpm %.2f err max %.3f (<= %.2f), jitter %.1f us rms, %u resyncs: %s\n",
+           c->name, rawMax * toUs, (steps > 0) ? stepSum / steps * toUs : 0.0, stepMax * toUs, c->maxStepErrorUs,
+           ClockFollower_Bpm(&cf), bpmErrorMax, c->maxBpmError, ClockFollower_JitterRmsUs(&cf), cf.resyncs, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            clockSeed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(clockCases) / sizeof(clockCases[0]); i++)
+    {
+        ok &= Clock_Run(&clockCases[i]);
+    }
+    return ok ? 0 : 1;
+}
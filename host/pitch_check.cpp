@@ -0,0 +1,130 @@
+/*
+ * checks the pitch tables and the fast exp2/log2 of pitch_table.h against libm
+ *
+ * - Pitch_Ratio and Pitch_Rate for every cent of the range
+ * - Pitch_Exp2, Pitch_Log2 and Pitch_Pow over the ranges used by the control changes,
+ *   the decay/release multiplier is also compared after one second of samples
+ *
+ * the time per call is printed next to the time of the libm function it replaced
+ *
+ * usage: pitch_check
+ *
+ * returns 1 when an error is above its limit
+ */
+#include <Arduino.h>
+#include <chrono>
+
+#include "pitch_table.h"
+
+/* the table is calculated by the compiler */
+static_assert(pitchTable.semitoneQ31[0] == 0x80000000u, "2^0");
+static_assert(pitchTable.centQ31[0] == 0x80000000u, "2^0");
+
+#define PITCH_CHECK_RATIO_ERROR     2e-7 /* relative, float resolution */
+#define PITCH_CHECK_RATE_ERROR      3e-9 /* relative, two Q31 factors and the rounding of the rate */
+#define PITCH_CHECK_EXP2_ERROR      3e-7
+#define PITCH_CHECK_LOG2_ERROR      1e-6 /* absolute */
+#define PITCH_CHECK_DECAY_ERROR     3e-3 /* relative level after one second, a float multiplier alone has 44100 * 2^-24 */
+
+static uint32_t errors = 0;
+
+static void PitchCheck_Report(const char *name, double maxError, double limit)
+{
+    bool ok = maxError <= limit;
+    printf("%-28s max error %.3g (limit %.3g) %s\n", name, maxError, limit, ok ? "ok" : "FAILED");
+    if (!ok)
+    {
+        errors++;
+    }
+}
+
+static inline uint64_t PitchCheck_Now(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* keeps the timed loops from being removed */
+volatile float pitchCheckSink;
+
+int main(int argc, char *argv[])
+{
+    double maxError = 0.0;
+    for (int cents = PITCH_CENTS_MIN; cents <= PITCH_CENTS_MAX; cents++)
+    {
+        double exact = pow(2.0, cents / 1200.0);
+        maxError = max(maxError, fabs(Pitch_Ratio(cents) / exact - 1.0));
+    }
+    PitchCheck_Report("Pitch_Ratio", maxError, PITCH_CHECK_RATIO_ERROR);
+
+    maxError = 0.0;
+    for (int cents = -4800; cents <= 2400; cents++)
+    {
+        double exact = pow(2.0, cents / 1200.0) * 4294967296.0;
+        maxError = max(maxError, fabs(Pitch_Rate(cents) / exact - 1.0));
+    }
+    PitchCheck_Report("Pitch_Rate", maxError, PITCH_CHECK_RATE_ERROR);
+    if (Pitch_Rate(0) != (1ULL << 32))
+    {
+        printf("Pitch_Rate(0) is not 1 << 32\n");
+        errors++;
+    }
+
+    maxError = 0.0;
+    for (float x = -8.0f; x <= 8.0f; x += 1.0f / 1024)
+    {
+        maxError = max(maxError, fabs(Pitch_Exp2(x) / exp2((double)x) - 1.0));
+    }
+    PitchCheck_Report("Pitch_Exp2", maxError, PITCH_CHECK_EXP2_ERROR);
+
+    maxError = 0.0;
+    for (float x = 1.0f / 65536; x <= 16.0f; x *= 1.0001f)
+    {
+        maxError = max(maxError, fabs(Pitch_Log2(x) - log2((double)x)));
+    }
+    PitchCheck_Report("Pitch_Log2", maxError, PITCH_CHECK_LOG2_ERROR);
+
+    /* the decay is applied every sample, the error of the multiplier adds up */
+    maxError = 0.0;
+    for (float value = 0.01f; value <= 1.0f; value += 0.01f)
+    {
+        double exact = pow((double)value, 10.0 / 44100.0);
+        double fast = Pitch_Pow(value, 10.0f / 44100.0f);
+        maxError = max(maxError, fabs(pow(fast / exact, 44100.0) - 1.0));
+    }
+    PitchCheck_Report("Pitch_Pow (decay after 1s)", maxError, PITCH_CHECK_DECAY_ERROR);
+
+    const int calls = 1 << 20;
+    uint64_t t0 = PitchCheck_Now();
+    for (int n = 0; n < calls; n++)
+    {
+        pitchCheckSink = powf(2.0f, (n & 0x7F) / 12.0f);
+    }
+    uint64_t t1 = PitchCheck_Now();
+    for (int n = 0; n < calls; n++)
+    {
+        pitchCheckSink = Pitch_Ratio((n & 0x7F) * 100);
+    }
+    uint64_t t2 = PitchCheck_Now();
+    for (int n = 0; n < calls; n++)
+    {
+        pitchCheckSink = Pitch_Exp2((n & 0x7F) / 12.0f);
+    }
+    uint64_t t3 = PitchCheck_Now();
+    for (int n = 0; n < calls; n++)
+    {
+        pitchCheckSink = powf((n & 0x7F) / 128.0f, 10.0f / 44100.0f);
+    }
+    uint64_t t4 = PitchCheck_Now();
+    for (int n = 0; n < calls; n++)
+    {
+        pitchCheckSink = Pitch_Pow((n & 0x7F) / 128.0f, 10.0f / 44100.0f);
+    }
+    uint64_t t5 = PitchCheck_Now();
+
+    printf("ns per call: powf(2, x) %.2f, Pitch_Ratio %.2f, Pitch_Exp2 %.2f, powf(x, y) %.2f, Pitch_Pow %.2f\n",
+           ((double)(t1 - t0)) / calls, ((double)(t2 - t1)) / calls, ((double)(t3 - t2)) / calls,
+           ((double)(t4 - t3)) / calls, ((double)(t5 - t4)) / calls);
+
+    printf("%u errors\n", errors);
+    return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+/*
+ * offline renderer for the audio engine
+ *
+ * runs a euclidean pattern through the same sequencer and audio chain as the firmware
+ * and writes the output of the i2s interface into a wav file
+ *
+ * usage: render [-o out.wav] [-b bpm] [-w swing] [-s seconds] [-r reverb] [-d dataDir] [-t bytes] [-P]
+ *               [-p len,pulses,offset,div]... [-l ring,step,velocity,pan,start,pitch,probability,micro,ratchet]...
+ *               [-T ring,semitones,cents]... [/samples/x.wav]...
+ *
+ * each -p sets the pattern of the next ring (len up to SEQ_MAX_STEPS), div is the index into divRatio like on the device
+ * -w sets the global swing in percent (50 straight .. 75)
+ * each -l locks the parameters of a step, -1 leaves a value unlocked (micro timing in frames, ratchet 1..8)
+ * each -T tunes a ring, the pitch locks of its steps are relative to the tuning
+ * -t sets the size above which wav files are streamed instead of loaded completely
+ * -P prints the results of the audio loop profiler and the stream underruns
+ * wav files are loaded from dataDir (like from the SD card), without files a synthetic kit is used
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "config.h"
+#include "euclid.h"
+#include "audio_task.h"
+#include "sequencer.h"
+
+#include "host_util.h"
+
+/* default pattern: len, pulses, offset, div */
+const uint8_t defaultPatterns[RINGS][4] =
+{
+    {16, 4, 0, 4},
+    {16, 2, 4, 4},
+    {16, 7, 0, 4},
+    {16, 3, 2, 4},
+};
+
+int main(int argc, char *argv[])
+{
+    const char *outFile = "render.wav";
+    float seconds = 10.0f;
+    float reverbLevel = 0.2f;
+    int patternCount = 0;
+    bool profile = false;
+    int opt;
+
+    for (int i = 0; i < RINGS; i++)
+    {
+        ringStates[i].loopLength = defaultPatterns[i][0];
+        ringStates[i].numNotes = defaultPatterns[i][1];
+        ringStates[i].offset = defaultPatterns[i][2];
+        ringStates[i].clkDiv = defaultPatterns[i][3];
+    }
+
+    while ((opt = getopt(argc, argv, "o:b:w:s:r:d:t:p:l:T:P")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            outFile = optarg;
+            break;
+        case 'b':
+            bpm = constrain(atoi(optarg), 1, 255);
+            break;
+        case 'w':
+            sequencerSwing = constrain(atoi(optarg), SEQ_SWING_MIN, SEQ_SWING_MAX);
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            reverbLevel = atof(optarg);
+            break;
+        case 'd':
+            SD_MMC.setRoot(optarg);
+            LITTLEFS.setRoot(optarg);
+            break;
+        case 't':
+            playerStreamThreshold = atoi(optarg);
+            break;
+        case 'P':
+            profile = true;
+            break;
+        case 'p':
+            if (patternCount < RINGS)
+            {
+                int len = 16, pulses = 0, offset = 0, div = 4;
+                sscanf(optarg, "%d,%d,%d,%d", &len, &pulses, &offset, &div);
+                ringStates[patternCount].loopLength = constrain(len, 1, SEQ_MAX_STEPS);
+                ringStates[patternCount].numNotes = constrain(pulses, 0, ringStates[patternCount].loopLength);
+                ringStates[patternCount].offset = constrain(offset, 0, ringStates[patternCount].loopLength - 1);
+                ringStates[patternCount].clkDiv = constrain(div, 0, 4);
+                patternCount++;
+            }
+            break;
+        case 'l':
+            {
+                int ring = 0, step = 0, velocity = -1, pan = -1, startPos = -1, pitch = -1, probability = -1, micro = 0, ratchet = 1;
+                sscanf(optarg, "%d,%d,%d,%d,%d,%d,%d,%d,%d", &ring, &step, &velocity, &pan, &startPos, &pitch, &probability, &micro, &ratchet);
+                struct seq_step_s lock = {};
+                if (velocity >= 0)
+                {
+                    lock.lock.flags |= PLAYER_LOCK_VELOCITY;
+                    lock.lock.velocity = constrain(velocity, 0, 255);
+                }
+                if (pan >= 0)
+                {
+                    lock.lock.flags |= PLAYER_LOCK_PAN;
+                    lock.lock.pan = constrain(pan, 0, 18);
+                }
+                if (startPos >= 0)
+                {
+                    lock.lock.flags |= PLAYER_LOCK_START;
+                    lock.lock.start = constrain(startPos, 0, 255);
+                }
+                if (pitch != -1)
+                {
+                    lock.lock.flags |= PLAYER_LOCK_PITCH;
+                    lock.lock.pitch = constrain(pitch, -48, 24);
+                }
+                if (probability >= 0)
+                {
+                    lock.lock.flags |= SEQ_LOCK_PROBABILITY;
+                    lock.probability = constrain(probability, 0, 100);
+                }
+                lock.microTiming = constrain(micro, -SEQ_MICRO_TIMING_MAX, SEQ_MICRO_TIMING_MAX);
+                lock.ratchet = constrain(ratchet, 1, SEQ_RATCHET_MAX);
+                if (!sequencerSendLock(ring, step, &lock))
+                {
+                    fprintf(stderr, "too many locks\n");
+                    return 1;
+                }
+            }
+            break;
+        case 'T':
+            {
+                int ring = 0, semitones = 0, cents = 0;
+                sscanf(optarg, "%d,%d,%d", &ring, &semitones, &cents);
+                sequencerSendTune(ring, constrain(semitones, -48, 24), constrain(cents, -99, 99));
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o out.wav] [-b bpm] [-w swing] [-s seconds] [-r reverb] [-d dataDir] [-t bytes] [-P] [-p len,pulses,offset,div]... [-l ring,step,velocity,pan,start,pitch,probability,micro,ratchet]... [-T ring,semitones,cents]... [wav]...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    playerInit();
+    Profiler_Reset();
+    static float *revBuffer = (float *)malloc(sizeof(float) * REV_BUFF_SIZE);
+    Reverb_Setup(revBuffer);
+    Reverb_SetLevel(0, reverbLevel);
+    Delay_Init();
+    Delay_Reset();
+
+    for (int i = 0; i < RINGS; i++)
+    {
+        if ((optind + i < argc) && playerLoadWav(i, argv[optind + i]) && samplePlayers[i].enabled)
+        {
+            continue;
+        }
+        Host_LoadSyntheticSample(i);
+    }
+
+    for (int i = 0; i < RINGS; i++)
+    {
+        if (ringStates[i].numNotes > 0)
+            ringStates[i].euclidNotes = euclid(ringStates[i].loopLength, ringStates[i].numNotes, ringStates[i].offset);
+        else
+            ringStates[i].euclidNotes = 0;
+        sequencerSendPattern(i, ringStates[i].loopLength, ringStates[i].euclidNotes);
+        sequencerSendDiv(i, ringStates[i].clkDiv);
+    }
+
+    struct host_wav_s wav;
+    if (!Host_WavOpen(&wav, outFile))
+    {
+        fprintf(stderr, "could not create %s\n", outFile);
+        return 1;
+    }
+    host_i2s_set_sink(Host_WavWrite, &wav);
+
+    /* the sequencer runs inside audio_task, clocked by the rendered frames */
+    const uint64_t totalSamples = (uint64_t)(seconds * SAMPLE_RATE);
+    uint64_t frame = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (frame < totalSamples)
+    {
+        audio_task();
+        /* on the device this is done by the task on core 0 */
+        playerStreamService();
+        frame += SAMPLE_BUFFER_SIZE;
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    host_i2s_set_sink(NULL, NULL);
+    Host_WavClose(&wav);
+
+    double renderTime = std::chrono::duration<double>(stop - start).count();
+    double audioTime = ((double)frame) / SAMPLE_RATE;
+    printf("rendered %.2f s of audio to %s in %.3f s (%.1fx real time)\n", audioTime, outFile, renderTime, audioTime / renderTime);
+
+    if (profile)
+    {
+        Profiler_Dump();
+        Serial.printf("Stream underruns: %u blocks, %u samples\n", playerStreamUnderruns, playerStreamUnderrunSamples);
+    }
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * checks the sampler of sample_player.h, the control task and the audio task are called in turns
+ *
+ * - two sines are recorded through Sampler_RecordProcess, the quiet one gets a gain above 1,
+ *   a block which the audio task writes after the stop was sent is part of the record
+ * - a note of the quiet record is played, the output level must be the recorded level times the gain
+ * - the quiet record is normalized by Sampler_Service while Sampler_Process renders,
+ *   afterwards the gain is part of the data and the output of the note must be unchanged
+ * - the quiet record is removed while both records play: the voices fade out without a jump,
+ *   the other record moves into its slot, removing that one as well frees the whole arena
+ *
+ * the sampler is not part of the drum firmware, this is the only build of sample_player.h
+ *
+ * returns 1 when a check fails
+ */
+#include <Arduino.h>
+
+#include "config.h"
+#include "player.h"
+#include "sample_player.h"
+
+#define SAMPLER_CHECK_QUIET     0.05f /* amplitude of the first record */
+#define SAMPLER_CHECK_LOUD      0.4f /* amplitude of the second record */
+#define SAMPLER_CHECK_OMEGA     0.05f /* radians per sample of both sines */
+#define SAMPLER_CHECK_BLOCKS    200 /* blocks rendered to compare the output */
+#define SAMPLER_CHECK_SERVICES  10000 /* limit of the Sampler_Service calls of one job */
+
+static uint32_t errors = 0;
+
+static void SamplerCheck_Error(const char *msg)
+{
+    printf("error: %s\n", msg);
+    errors++;
+}
+
+/*
+ * one call of the control task and one block of the audio task,
+ * returns the peak of the left channel and keeps the largest step between two frames in maxStep
+ */
+static float SamplerCheck_Step(float *out, float *maxStep)
+{
+    static float prev = 0.0f;
+    float l[SAMPLE_BUFFER_SIZE] = {0};
+    float r[SAMPLE_BUFFER_SIZE] = {0};
+    float peak = 0.0f;
+
+    Sampler_Service();
+    Sampler_Process(l, r, SAMPLE_BUFFER_SIZE);
+
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+        peak = max(peak, fabsf(l[n]));
+        *maxStep = max(*maxStep, fabsf(l[n] - prev));
+        prev = l[n];
+        if (out != NULL)
+        {
+            out[n] = l[n];
+        }
+    }
+    return peak;
+}
+
+/*
+ * records blocks of a sine, one more block arrives after the stop was sent, before the audio task applied it
+ */
+static void SamplerCheck_Record(float amp, uint32_t blocks)
+{
+    static uint32_t phase = 0;
+    float in_l[SAMPLE_BUFFER_SIZE];
+    float in_r[SAMPLE_BUFFER_SIZE];
+    float maxStep = 0.0f;
+
+    Sampler_Record(0, 1);
+    SamplerCheck_Step(NULL, &maxStep);
+    for (uint32_t b = 0; b <= blocks; b++)
+    {
+        for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++, phase++)
+        {
+            in_l[n] = amp * sinf(phase * SAMPLER_CHECK_OMEGA);
+            in_r[n] = in_l[n];
+        }
+        Sampler_RecordProcess(in_l, in_r, SAMPLE_BUFFER_SIZE);
+        if (b == blocks - 1)
+        {
+            Sampler_Record(0, 0);
+        }
+        else if (b < blocks)
+        {
+            SamplerCheck_Step(NULL, &maxStep);
+        }
+    }
+
+    uint32_t services = 0;
+    while ((sampleStatus != sampler_idle) && (services < SAMPLER_CHECK_SERVICES))
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+        services++;
+    }
+    if (sampleStatus != sampler_idle)
+    {
+        SamplerCheck_Error("the recording does not finish");
+    }
+    if ((sampleRecordCount == 0) || (sampleRecords[sampleRecordCount - 1].end != (blocks + 1) * SAMPLE_BUFFER_SIZE))
+    {
+        SamplerCheck_Error("the record does not contain all blocks written by the audio task");
+    }
+}
+
+/*
+ * plays the first record at its recorded speed, the voices of the previous render are stopped before
+ */
+static float SamplerCheck_Render(float *out)
+{
+    float maxStep = 0.0f;
+    float peak = 0.0f;
+
+    for (uint8_t slot = 0; slot < NUM_PLAYERS; slot++)
+    {
+        Sampler_SendStop(slot);
+    }
+    for (int i = 0; i < SAMPLER_REMOVE_PASSES; i++)
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+    }
+
+    Sampler_NoteOn(1, NOTE_NORMAL, 1.0f);
+    for (int b = 0; b < SAMPLER_CHECK_BLOCKS; b++)
+    {
+        peak = max(peak, SamplerCheck_Step(&out[b * SAMPLE_BUFFER_SIZE], &maxStep));
+    }
+    return peak;
+}
+
+static void SamplerCheck_Remove(float *maxStep)
+{
+    lastActiveRec = &sampleRecords[0];
+    Sampler_RemoveActiveRecording(0, 1);
+
+    uint32_t services = 0;
+    while ((samplerRemove.rec != NULL) && (services < SAMPLER_CHECK_SERVICES))
+    {
+        SamplerCheck_Step(NULL, maxStep);
+        services++;
+    }
+    if (samplerRemove.rec != NULL)
+    {
+        SamplerCheck_Error("the removal does not finish");
+    }
+}
+
+int main(void)
+{
+    static float before[SAMPLER_CHECK_BLOCKS * SAMPLE_BUFFER_SIZE];
+    static float after[SAMPLER_CHECK_BLOCKS * SAMPLE_BUFFER_SIZE];
+
+    Serial.enabled = false;
+
+    playerInit();
+    Sampler_Init();
+
+    /* recording */
+    SamplerCheck_Record(SAMPLER_CHECK_QUIET, 500);
+    SamplerCheck_Record(SAMPLER_CHECK_LOUD, 700);
+    if ((sampleRecordCount != 2) || !sampleRecords[0].valid || !sampleRecords[1].valid)
+    {
+        SamplerCheck_Error("the records are missing");
+        printf("%u errors\n", errors);
+        return 1;
+    }
+    if (sampleRecords[0].gain <= 1.0f)
+    {
+        SamplerCheck_Error("the quiet record is not amplified");
+    }
+    printf("record: %u and %u samples, gain %.3f and %.3f\n", sampleRecords[0].end - sampleRecords[0].start,
+           sampleRecords[1].end - sampleRecords[1].start, sampleRecords[0].gain, sampleRecords[1].gain);
+
+    /* playback, Sampler_Process brings the center pan of the slot to 0.25 */
+    const float expected = SAMPLER_CHECK_QUIET * sampleRecords[0].gain * 0.25f;
+    const float peakBefore = SamplerCheck_Render(before);
+    if (fabsf(peakBefore - expected) > 0.02f * expected)
+    {
+        SamplerCheck_Error("the output level does not match the record");
+    }
+
+    /* normalization while rendering */
+    lastActiveRec = &sampleRecords[0];
+    Sampler_NormalizeActiveRecording(0, 1);
+    float maxStep = 0.0f;
+    uint32_t services = 0;
+    while ((samplerNormalize.state != sampler_normalize_idle) && (services < SAMPLER_CHECK_SERVICES))
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+        services++;
+    }
+    if (samplerNormalize.state != sampler_normalize_idle)
+    {
+        SamplerCheck_Error("the normalization does not finish");
+    }
+    if (sampleRecords[0].gain != 1.0f)
+    {
+        SamplerCheck_Error("the normalized record has a gain");
+    }
+
+    const float peakAfter = SamplerCheck_Render(after);
+    float diff = 0.0f;
+    for (int i = 0; i < SAMPLER_CHECK_BLOCKS * SAMPLE_BUFFER_SIZE; i++)
+    {
+        diff = max(diff, fabsf(before[i] - after[i]));
+    }
+    /* the data is rounded to 16 bit once more */
+    if (diff > 2.0f / 32768.0f)
+    {
+        SamplerCheck_Error("the output changed with the normalization");
+    }
+    printf("level: peak %.4f expected %.4f, normalized in %u services, peak %.4f, max diff %.2e\n",
+           peakBefore, expected, services, peakAfter, diff);
+
+    /* removal while both records play */
+    maxStep = 0.0f;
+    Sampler_NoteOn(2, NOTE_NORMAL, 1.0f);
+    for (int i = 0; i < 20; i++)
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+    }
+    const uint32_t moved = sampleRecords[1].end - sampleRecords[1].start;
+    const float stepPlaying = maxStep;
+
+    maxStep = 0.0f;
+    SamplerCheck_Remove(&maxStep);
+    for (int i = 0; i < 10; i++)
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+    }
+    if (maxStep > stepPlaying)
+    {
+        SamplerCheck_Error("the output jumps when the voices are stopped");
+    }
+    if ((sampleRecordCount != 1) || !sampleRecords[0].valid || sampleRecords[1].valid
+            || ((sampleRecords[0].end - sampleRecords[0].start) != moved))
+    {
+        SamplerCheck_Error("the last record did not move into the slot");
+    }
+    if ((samplePlayers[0].numSamples != moved) || samplePlayers[1].enabled)
+    {
+        SamplerCheck_Error("the slots do not follow the records");
+    }
+    if (playerVoiceMask != 0)
+    {
+        SamplerCheck_Error("voices of the removed records are still playing");
+    }
+    printf("remove: largest step %.4f playing, %.4f stopping\n", stepPlaying, maxStep);
+
+    /* the last record stays counted like before, but it is not valid anymore */
+    SamplerCheck_Remove(&maxStep);
+    services = 0;
+    while ((SampleArena_FreeTotal() != sampleArena.len) && (services < SAMPLER_CHECK_SERVICES))
+    {
+        SamplerCheck_Step(NULL, &maxStep);
+        services++;
+    }
+    if (sampleRecords[0].valid || (SampleArena_FreeTotal() != sampleArena.len))
+    {
+        SamplerCheck_Error("the data of the removed records is not freed");
+    }
+    printf("free: %u of %u samples after %u services\n", SampleArena_FreeTotal(), sampleArena.len, services);
+
+    printf("%u errors\n", errors);
+    return (errors == 0) ? 0 : 1;
+}
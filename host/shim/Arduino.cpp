@@ -0,0 +1,111 @@
+/*
+ * implementation of the host Arduino/ESP32 shim
+ */
+#include <Arduino.h>
+
+#include <chrono>
+#include <thread>
+
+static const auto hostStartTime = std::chrono::steady_clock::now();
+static size_t psramUsed = 0;
+
+EspClass ESP;
+HardwareSerial Serial;
+
+unsigned long micros(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStartTime).count();
+}
+
+unsigned long millis(void)
+{
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield(void)
+{
+    std::this_thread::yield();
+}
+
+bool psramInit(void)
+{
+    return true;
+}
+
+void *ps_malloc(size_t size)
+{
+    if (psramUsed + size > HOST_PSRAM_SIZE)
+    {
+        return NULL;
+    }
+    psramUsed += size;
+    return malloc(size);
+}
+
+uint32_t EspClass::getPsramSize(void)
+{
+    return HOST_PSRAM_SIZE;
+}
+
+uint32_t EspClass::getFreePsram(void)
+{
+    return HOST_PSRAM_SIZE - psramUsed;
+}
+
+size_t HardwareSerial::printf(const char *format, ...)
+{
+    if (!enabled)
+    {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(stderr, format, args);
+    va_end(args);
+    return (n > 0) ? n : 0;
+}
+
+size_t HardwareSerial::print(const char *str)
+{
+    return printf("%s", str);
+}
+
+size_t HardwareSerial::print(char c)
+{
+    return printf("%c", c);
+}
+
+size_t HardwareSerial::print(int value, int base)
+{
+    return print((long)value, base);
+}
+
+size_t HardwareSerial::print(unsigned int value, int base)
+{
+    return print((unsigned long)value, base);
+}
+
+size_t HardwareSerial::print(long value, int base)
+{
+    return (base == HEX) ? printf("%lx", value) : printf("%ld", value);
+}
+
+size_t HardwareSerial::print(unsigned long value, int base)
+{
+    return (base == HEX) ? printf("%lx", value) : printf("%lu", value);
+}
+
+size_t HardwareSerial::print(double value, int digits)
+{
+    return printf("%.*f", digits, value);
+}
+
+size_t HardwareSerial::println(void)
+{
+    return printf("\n");
+}
@@ -0,0 +1,98 @@
+/*
+ * this file is a very thin Arduino/ESP32 shim which allows the audio engine
+ * to be compiled and run on a linux host
+ *
+ * only the parts used by the audio modules are provided:
+ * - Serial printing (goes to stderr, stdout is kept free for tool output)
+ * - timing (micros, millis, delay)
+ * - PSRAM allocation, the PSRAM size is simulated to get the same limits
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define DEC 10
+#define HEX 16
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+/* simulated PSRAM size of the ESP32-WROVER */
+#define HOST_PSRAM_SIZE (4 * 1024 * 1024)
+
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+void yield(void);
+
+bool psramInit(void);
+void *ps_malloc(size_t size);
+
+class EspClass
+{
+public:
+    uint32_t getPsramSize(void);
+    uint32_t getFreePsram(void);
+};
+
+extern EspClass ESP;
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long /* baud */) {}
+
+    /* there is no input on the host */
+    int available(void)
+    {
+        return 0;
+    }
+    int read(void)
+    {
+        return -1;
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println(void);
+    template <typename T> size_t println(T value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T> size_t println(T value, int format)
+    {
+        size_t n = print(value, format);
+        return n + println();
+    }
+
+    /* set to false to mute all logging of the engine */
+    bool enabled = true;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,175 @@
+/*
+ * implementation of the host file system shim
+ */
+#include <FS.h>
+#include <SD_MMC.h>
+#include <LITTLEFS.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace fs
+{
+
+class FileImpl
+{
+public:
+    ~FileImpl()
+    {
+        close();
+    }
+
+    void close(void)
+    {
+        if (fp != NULL)
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+        if (dir != NULL)
+        {
+            closedir(dir);
+            dir = NULL;
+        }
+    }
+
+    FILE *fp = NULL;
+    DIR *dir = NULL;
+    std::string hostPath; /* path on the host */
+    std::string path; /* path seen by the firmware */
+};
+
+static std::shared_ptr<FileImpl> openHostPath(const std::string &hostPath, const std::string &path, const char *mode)
+{
+    auto impl = std::make_shared<FileImpl>();
+    impl->hostPath = hostPath;
+    impl->path = path;
+
+    struct stat st;
+    if ((stat(hostPath.c_str(), &st) == 0) && S_ISDIR(st.st_mode))
+    {
+        impl->dir = opendir(hostPath.c_str());
+    }
+    else
+    {
+        impl->fp = fopen(hostPath.c_str(), (mode[0] == 'r') ? "rb" : (mode[0] == 'a') ? "ab" : "wb");
+    }
+
+    if ((impl->fp == NULL) && (impl->dir == NULL))
+    {
+        return nullptr;
+    }
+    return impl;
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+    return (impl && impl->fp) ? fwrite(buf, 1, size, impl->fp) : 0;
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+    return (impl && impl->fp) ? fread(buf, 1, size, impl->fp) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+    return (impl && impl->fp) ? (fseek(impl->fp, pos, mode) == 0) : false;
+}
+
+size_t File::size(void) const
+{
+    struct stat st;
+    if (impl && (stat(impl->hostPath.c_str(), &st) == 0))
+    {
+        return st.st_size;
+    }
+    return 0;
+}
+
+void File::close(void)
+{
+    if (impl)
+    {
+        impl->close();
+    }
+}
+
+const char *File::name(void) const
+{
+    return impl ? impl->path.c_str() : "";
+}
+
+bool File::isDirectory(void) const
+{
+    return impl && (impl->dir != NULL);
+}
+
+File File::openNextFile(void)
+{
+    if (!isDirectory())
+    {
+        return File();
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(impl->dir)) != NULL)
+    {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+        {
+            continue;
+        }
+        std::string path = impl->path + "/" + entry->d_name;
+        std::string hostPath = impl->hostPath + "/" + entry->d_name;
+        return File(openHostPath(hostPath, path, FILE_READ));
+    }
+    return File();
+}
+
+File::operator bool() const
+{
+    return impl != nullptr;
+}
+
+std::string FS::hostPath(const char *path) const
+{
+    return root + ((path[0] == '/') ? "" : "/") + path;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+    return File(openHostPath(hostPath(path), path, mode));
+}
+
+bool FS::exists(const char *path)
+{
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+} // namespace fs
+
+bool SDMMCFS::begin(const char * /* mountpoint */, bool /* mode1bit */)
+{
+    struct stat st;
+    return (stat(root.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+uint8_t SDMMCFS::cardType(void)
+{
+    return CARD_SD;
+}
+
+bool LITTLEFSFS::begin(void)
+{
+    struct stat st;
+    return (stat(root.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+SDMMCFS SD_MMC;
+LITTLEFSFS LITTLEFS;
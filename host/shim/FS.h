@@ -0,0 +1,77 @@
+/*
+ * host version of the ESP32 file system interface
+ *
+ * all paths are relative to a root directory on the host,
+ * the root can be changed using setRoot (default: data)
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class FileImpl;
+
+class File
+{
+public:
+    File() {}
+    File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+    size_t write(const uint8_t *buf, size_t size);
+    size_t read(uint8_t *buf, size_t size);
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t size(void) const;
+    void close(void);
+    const char *name(void) const;
+    bool isDirectory(void) const;
+    File openNextFile(void);
+
+    operator bool() const;
+
+private:
+    std::shared_ptr<FileImpl> impl;
+};
+
+class FS
+{
+public:
+    FS(const char *root = "data") : root(root) {}
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool mkdir(const char *path);
+
+    void setRoot(const char *newRoot)
+    {
+        root = newRoot;
+    }
+
+protected:
+    std::string hostPath(const char *path) const;
+    std::string root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
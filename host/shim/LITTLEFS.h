@@ -0,0 +1,15 @@
+/*
+ * host version of the LITTLEFS file system
+ */
+#pragma once
+
+#include <FS.h>
+
+class LITTLEFSFS : public fs::FS
+{
+public:
+    bool begin(void);
+    void end(void) {}
+};
+
+extern LITTLEFSFS LITTLEFS;
@@ -0,0 +1,25 @@
+/*
+ * host version of the SD_MMC file system
+ */
+#pragma once
+
+#include <FS.h>
+
+enum sdcard_type_t
+{
+    CARD_NONE,
+    CARD_MMC,
+    CARD_SD,
+    CARD_SDHC,
+    CARD_UNKNOWN
+};
+
+class SDMMCFS : public fs::FS
+{
+public:
+    bool begin(const char *mountpoint = "/sdcard", bool mode1bit = false);
+    void end(void) {}
+    uint8_t cardType(void);
+};
+
+extern SDMMCFS SD_MMC;
@@ -0,0 +1,97 @@
+/*
+ * host version of the ESP32 i2s driver
+ *
+ * written samples are forwarded to a sink callback
+ * which can be set using host_i2s_set_sink (i.e. to write a wav file)
+ */
+#pragma once
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK      0
+#define ESP_FAIL    -1
+
+#define portMAX_DELAY   0xFFFFFFFF
+
+#define ESP_INTR_FLAG_LEVEL1    (1 << 1)
+
+typedef enum
+{
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+    I2S_NUM_MAX,
+} i2s_port_t;
+
+typedef enum
+{
+    I2S_MODE_MASTER = 1,
+    I2S_MODE_SLAVE = 2,
+    I2S_MODE_TX = 4,
+    I2S_MODE_RX = 8,
+    I2S_MODE_DAC_BUILT_IN = 16,
+} i2s_mode_t;
+
+typedef enum
+{
+    I2S_BITS_PER_SAMPLE_8BIT = 8,
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+    I2S_BITS_PER_SAMPLE_24BIT = 24,
+    I2S_BITS_PER_SAMPLE_32BIT = 32,
+} i2s_bits_per_sample_t;
+
+typedef enum
+{
+    I2S_CHANNEL_FMT_RIGHT_LEFT = 0,
+    I2S_CHANNEL_FMT_ALL_RIGHT,
+    I2S_CHANNEL_FMT_ALL_LEFT,
+    I2S_CHANNEL_FMT_ONLY_RIGHT,
+    I2S_CHANNEL_FMT_ONLY_LEFT,
+} i2s_channel_fmt_t;
+
+typedef enum
+{
+    I2S_COMM_FORMAT_I2S = 0x01,
+    I2S_COMM_FORMAT_I2S_MSB = 0x02,
+    I2S_COMM_FORMAT_I2S_LSB = 0x04,
+} i2s_comm_format_t;
+
+typedef struct
+{
+    i2s_mode_t mode;
+    int sample_rate;
+    i2s_bits_per_sample_t bits_per_sample;
+    i2s_channel_fmt_t channel_format;
+    i2s_comm_format_t communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    bool use_apll;
+} i2s_config_t;
+
+typedef struct
+{
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+} i2s_pin_config_t;
+
+/* register access used by setup_i2s, nothing to do on the host */
+#define PIN_CTRL    0
+#define PERIPHS_IO_MUX_GPIO0_U  0
+#define FUNC_GPIO0_CLK_OUT1 0
+#define REG_WRITE(reg, val) ((void)(reg), (void)(val))
+#define PIN_FUNC_SELECT(reg, func)  ((void)(reg), (void)(func))
+
+typedef void (*host_i2s_sink_t)(const void *src, size_t size, void *user);
+
+void host_i2s_set_sink(host_i2s_sink_t sink, void *user);
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t *i2s_config, int queue_size, void *i2s_queue);
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t *pin);
+esp_err_t i2s_set_sample_rates(i2s_port_t i2s_num, uint32_t rate);
+esp_err_t i2s_start(i2s_port_t i2s_num);
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, uint32_t ticks_to_wait);
+esp_err_t i2s_read(i2s_port_t i2s_num, void *dest, size_t size, size_t *bytes_read, uint32_t ticks_to_wait);
@@ -0,0 +1,378 @@
+/*
+ * measures the timing accuracy of the triggers
+ *
+ * clicks (single impulses) are triggered at known frames with random spacing,
+ * the output of the i2s interface is captured and the onset of every click is compared with its frame
+ *
+ * two modes are measured:
+ * - block: playerSampleOn before the block, the trigger lands at the start of the block
+ * - scheduled: AudioCmd_SampleOn with the frame of the trigger
+ *
+ * then the sequencer plays every step of a ring at several tempos with swing, ratchets and random micro timing,
+ * the expected frames are calculated with exact integer math
+ *
+ * at last all rings play the maximum of ratchets on every step, every trigger must be started
+ *
+ * usage: timing [-n clicks] [-s seed]
+ *
+ * returns 1 when a scheduled click or a sequencer step is not at its exact frame
+ */
+#include <algorithm>
+#include <Arduino.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "audio_task.h"
+#include "sequencer.h"
+
+#include "host_util.h"
+
+struct timing_capture_s
+{
+    std::vector<int16_t> left;
+};
+
+void Timing_Capture(const void *src, size_t size, void *user)
+{
+    struct timing_capture_s *capture = (struct timing_capture_s *)user;
+    const int16_t *samples = (const int16_t *)src;
+    for (size_t n = 0; n < size / (CHANNEL_COUNT * sizeof(int16_t)); n++)
+    {
+        capture->left.push_back(samples[n * CHANNEL_COUNT]);
+    }
+}
+
+struct timing_result_s
+{
+    uint32_t found;
+    uint32_t exact;
+    uint32_t maxError;
+    double avgError;
+};
+
+/*
+ * renders the clicks and returns the error of the onsets in frames
+ */
+struct timing_result_s Timing_Run(const std::vector<uint32_t> &clicks, bool scheduled)
+{
+    struct timing_capture_s capture;
+    struct timing_result_s result = {0, 0, 0, 0.0};
+
+    playerStopAll();
+    host_i2s_set_sink(Timing_Capture, &capture);
+
+    uint32_t end = clicks.back() + 4 * SAMPLE_BUFFER_SIZE;
+    size_t next = 0;
+    for (uint32_t frame = 0; frame < end; frame += SAMPLE_BUFFER_SIZE)
+    {
+        while ((next < clicks.size()) && (clicks[next] < frame + SAMPLE_BUFFER_SIZE))
+        {
+            if (scheduled)
+            {
+                AudioCmd_SampleOn(0, audioFrame + (clicks[next] - frame));
+            }
+            else
+            {
+                playerSampleOn(0);
+            }
+            next++;
+        }
+        audio_task();
+    }
+    host_i2s_set_sink(NULL, NULL);
+
+    /* the onset of a click is the first frame which is not silent */
+    next = 0;
+    uint64_t errorSum = 0;
+    for (uint32_t n = 0; (n < capture.left.size()) && (next < clicks.size()); n++)
+    {
+        if (capture.left[n] != 0)
+        {
+            uint32_t error = (n > clicks[next]) ? (n - clicks[next]) : (clicks[next] - n);
+            result.found++;
+            result.exact += (error == 0) ? 1 : 0;
+            result.maxError = max(result.maxError, error);
+            errorSum += error;
+            next++;
+        }
+    }
+    result.avgError = (result.found > 0) ? ((double)errorSum) / result.found : 0.0;
+    return result;
+}
+
+/*
+ * plays all steps of ring 0 for the given time and compares the onsets with the exact frames of the steps
+ */
+struct timing_result_s Timing_RunSequencer(uint8_t tempo, uint8_t globalSwing, uint8_t ringSwing, int8_t clkDiv, uint8_t ratchet, uint32_t frames, uint32_t *seed, uint32_t *expectedCount)
+{
+    struct timing_capture_s capture;
+    struct timing_result_s result = {0, 0, 0, 0.0};
+    const uint8_t loopLength = 16;
+
+    frames = ((frames + SAMPLE_BUFFER_SIZE - 1) / SAMPLE_BUFFER_SIZE) * SAMPLE_BUFFER_SIZE; /* the steps are stopped after a block */
+
+    playerStopAll();
+    for (int i = 0; i < RINGS; i++)
+    {
+        sequencerRings[i].euclidNotes = 0;
+        sequencerRings[i].activeNote = -1;
+        sequencerRings[i].loopLength = loopLength;
+        sequencerRings[i].clkDiv = 4;
+        sequencerRings[i].swing = 0;
+    }
+    sequencerRings[0].euclidNotes = (1ULL << loopLength) - 1;
+    sequencerRings[0].clkDiv = clkDiv;
+    sequencerRings[0].swing = ringSwing;
+    sequencerSwing = globalSwing;
+    bpm = tempo;
+    seq_counter = 1;
+    sequencerNextTick = 0;
+
+    int16_t micro[16];
+    for (int i = 0; i < loopLength; i++)
+    {
+        *seed = *seed * 1664525 + 1013904223;
+        micro[i] = (int32_t)((*seed >> 8) % (SEQ_MICRO_TIMING_MAX + 1)) - SEQ_MICRO_TIMING_MAX / 2;
+        if (ratchet > 1)
+        {
+            /* the repeats of neighboring steps would overlap */
+            micro[i] = 0;
+        }
+        struct seq_step_s lock = {};
+        lock.microTiming = micro[i];
+        lock.ratchet = ratchet;
+        sequencerSendLock(0, i, &lock);
+    }
+
+    /*
+     * the sequencer sees the ticks up to SEQ_MICRO_TIMING_MAX after the last rendered frame
+     * tick n is at n * SAMPLE_RATE * 15 / bpm, a swung step adds (swing - 50) / 50 of its length,
+     * repeat r of a ratchet adds r / ratchet of the step length
+     */
+    std::vector<uint32_t> expected;
+    uint8_t swing = (ringSwing != 0) ? ringSwing : globalSwing;
+    int step = -1;
+    for (uint64_t n = 0; n * SAMPLE_RATE * 15 < ((uint64_t)frames + SEQ_MICRO_TIMING_MAX) * tempo; n++)
+    {
+        if (((n % max_div) + 1) % divRatio[clkDiv] == 0)
+        {
+            step = (step + 1) % loopLength;
+            uint64_t num = (uint64_t)SAMPLE_RATE * 15 * (50 * n + ((step & 1) ? (swing - SEQ_SWING_MIN) * divRatio[clkDiv] : 0));
+            int32_t due = num / (50 * tempo) + micro[step];
+            /* steps at the start cannot be early, the clock was not running before */
+            int32_t lead = (n * SAMPLE_RATE * 15) / tempo;
+            due = max(due, (int32_t)(num / (50 * tempo)) - min(lead, (int32_t)SEQ_MICRO_TIMING_MAX));
+            expected.push_back(due);
+            for (uint32_t r = 1; r < ratchet; r++)
+            {
+                uint64_t repeat = num * ratchet + (uint64_t)SAMPLE_RATE * 15 * 50 * divRatio[clkDiv] * r;
+                expected.push_back(repeat / (50 * tempo * ratchet) + micro[step]);
+            }
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    *expectedCount = expected.size();
+
+    host_i2s_set_sink(Timing_Capture, &capture);
+    uint32_t end = frames + 2 * SEQ_MICRO_TIMING_MAX + (SAMPLE_RATE * 15 / tempo) * divRatio[clkDiv] + 4 * SAMPLE_BUFFER_SIZE;
+    for (uint32_t frame = 0; frame < end; frame += SAMPLE_BUFFER_SIZE)
+    {
+        if (frame == frames)
+        {
+            /* stop, the queued steps are still played */
+            sequencerRings[0].euclidNotes = 0;
+        }
+        audio_task();
+    }
+    host_i2s_set_sink(NULL, NULL);
+
+    size_t next = 0;
+    uint64_t errorSum = 0;
+    for (uint32_t n = 0; (n < capture.left.size()) && (next < expected.size()); n++)
+    {
+        if (capture.left[n] != 0)
+        {
+            uint32_t error = (n > expected[next]) ? (n - expected[next]) : (expected[next] - n);
+            result.found++;
+            result.exact += (error == 0) ? 1 : 0;
+            result.maxError = max(result.maxError, error);
+            errorSum += error;
+            next++;
+        }
+    }
+    result.avgError = (result.found > 0) ? ((double)errorSum) / result.found : 0.0;
+
+    sequencerSendClearLocks(0);
+    return result;
+}
+
+/*
+ * every step of every ring plays SEQ_RATCHET_MAX triggers with random micro timing,
+ * returns the triggers which were started, expectedCount is the number of triggers of the played steps,
+ * maxQueued the largest number of triggers left in the local queue after a block
+ * the triggers of the rings fall on the same frames, so they are counted at the queue and not in the output
+ */
+uint32_t Timing_RunRatchets(uint8_t tempo, uint32_t frames, uint32_t *seed, uint32_t *expectedCount, uint32_t *maxQueued)
+{
+    const uint8_t loopLength = 16;
+
+    frames = ((frames + SAMPLE_BUFFER_SIZE - 1) / SAMPLE_BUFFER_SIZE) * SAMPLE_BUFFER_SIZE;
+
+    playerStopAll();
+    for (int i = 0; i < RINGS; i++)
+    {
+        sequencerRings[i].euclidNotes = (1ULL << loopLength) - 1;
+        sequencerRings[i].activeNote = -1;
+        sequencerRings[i].loopLength = loopLength;
+        sequencerRings[i].clkDiv = 4;
+        sequencerRings[i].swing = 0;
+        for (int n = 0; n < loopLength; n++)
+        {
+            struct seq_step_s lock = {};
+            *seed = *seed * 1664525 + 1013904223;
+            lock.microTiming = (int32_t)((*seed >> 8) % (2 * SEQ_MICRO_TIMING_MAX + 1)) - SEQ_MICRO_TIMING_MAX;
+            lock.ratchet = SEQ_RATCHET_MAX;
+            sequencerSendLock(i, n, &lock);
+        }
+        /* the locks of all rings do not fit into sequencerCmdQueue at once */
+        sequencerCommands();
+    }
+    sequencerSwing = SEQ_SWING_MAX;
+    bpm = tempo;
+    seq_counter = 1;
+    sequencerNextTick = 0;
+
+    /* one step per tick, the ticks up to SEQ_MICRO_TIMING_MAX after the last rendered frame are played */
+    uint32_t steps = 0;
+    for (uint64_t n = 0; n * SAMPLE_RATE * 15 < ((uint64_t)frames + SEQ_MICRO_TIMING_MAX) * tempo; n++)
+    {
+        steps++;
+    }
+    *expectedCount = steps * RINGS * SEQ_RATCHET_MAX;
+
+    const uint32_t started = audioLocalCmdQueue.read;
+    *maxQueued = 0;
+    uint32_t end = frames + 2 * SEQ_MICRO_TIMING_MAX + 2 * SAMPLE_RATE * 15 / tempo + 4 * SAMPLE_BUFFER_SIZE;
+    for (uint32_t frame = 0; frame < end; frame += SAMPLE_BUFFER_SIZE)
+    {
+        if (frame == frames)
+        {
+            for (int i = 0; i < RINGS; i++)
+            {
+                sequencerRings[i].euclidNotes = 0;
+            }
+        }
+        audio_task();
+        *maxQueued = max(*maxQueued, audioLocalCmdQueue.write - audioLocalCmdQueue.read);
+    }
+
+    for (int i = 0; i < RINGS; i++)
+    {
+        sequencerSendClearLocks(i);
+        sequencerRings[i].euclidNotes = 0;
+    }
+    sequencerSwing = SEQ_SWING_MIN;
+    return audioLocalCmdQueue.read - started;
+}
+
+void Timing_Print(const char *name, const struct timing_result_s &result, uint32_t clicks)
+{
+    printf("%-10s %u/%u clicks found, %u exact, error avg %.1f frames, max %u frames (%.2f ms)\n", name,
+           result.found, clicks, result.exact, result.avgError, result.maxError, 1000.0 * result.maxError / SAMPLE_RATE);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t numClicks = 1000;
+    uint32_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            numClicks = max(1, atoi(optarg));
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n clicks] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Serial.enabled = false;
+
+    playerInit();
+    static float *revBuffer = (float *)malloc(sizeof(float) * REV_BUFF_SIZE);
+    Reverb_Setup(revBuffer);
+    Reverb_SetLevel(0, 0.0f);
+    Host_LoadClickSample(0);
+
+    /* random spacing between 1 and 8 blocks, so the clicks land on every offset of a block */
+    std::vector<uint32_t> clicks;
+    uint32_t frame = SAMPLE_BUFFER_SIZE;
+    for (uint32_t i = 0; i < numClicks; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        frame += SAMPLE_BUFFER_SIZE + (seed >> 8) % (7 * SAMPLE_BUFFER_SIZE);
+        clicks.push_back(frame);
+    }
+
+    struct timing_result_s block = Timing_Run(clicks, false);
+    struct timing_result_s scheduled = Timing_Run(clicks, true);
+
+    Timing_Print("block", block, numClicks);
+    Timing_Print("scheduled", scheduled, numClicks);
+    printf("late events: %u\n", audioCmdLate);
+
+    bool ok = (scheduled.found == numClicks) && (scheduled.exact == numClicks);
+
+    /* tempo, global swing, ring swing, clock divider, ratchet */
+    const uint8_t cases[][5] =
+    {
+        {120, 50, 0, 4, 1},
+        {97, 62, 0, 4, 1},
+        {133, 50, 66, 4, 1},
+        {61, 58, 71, 3, 1},
+        {177, 75, 0, 2, 1},
+        {255, 70, 0, 4, 1},
+        {30, 50, 54, 4, 1},
+        {143, 66, 50, 4, 1},
+        {120, 50, 0, 4, 3},
+        {113, 60, 0, 3, 8},
+        {255, 50, 0, 4, 8},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        uint32_t expectedCount;
+        uint32_t frames = 200 * SAMPLE_RATE * 15 / cases[i][0]; /* also covers the ticks which fall exactly on a frame */
+        struct timing_result_s steps = Timing_RunSequencer(cases[i][0], cases[i][1], cases[i][2], cases[i][3], cases[i][4], frames, &seed, &expectedCount);
+        char name[64];
+        snprintf(name, sizeof(name), "seq %3u bpm swing %u/%u div %u ratchet %u", cases[i][0], cases[i][1], cases[i][2], divRatio[cases[i][3]], cases[i][4]);
+        printf("%-44s %u/%u steps found, %u exact, max error %u frames\n", name, steps.found, expectedCount, steps.exact, steps.maxError);
+        ok = ok && (steps.found == expectedCount) && (steps.exact == expectedCount);
+    }
+
+    /*
+     * the busiest pattern: all rings, all steps with the maximum of triggers at the highest tempo,
+     * the queue must keep room, a faster midi clock plays more steps within the lookahead
+     */
+    for (uint8_t tempo : {255, 120})
+    {
+        uint32_t expectedCount, maxQueued;
+        uint32_t started = Timing_RunRatchets(tempo, 100 * SAMPLE_RATE * 15 / tempo, &seed, &expectedCount, &maxQueued);
+        char name[64];
+        snprintf(name, sizeof(name), "seq %3u bpm %u rings ratchet %u", tempo, RINGS, SEQ_RATCHET_MAX);
+        printf("%-44s %u/%u triggers started, %u dropped, %u/%u queued\n", name, started, expectedCount,
+               audioLocalCmdQueue.dropped + sequencerRatchetsDropped, maxQueued, AUDIO_CMD_QUEUE_LEN);
+        ok = ok && (started == expectedCount) && (audioLocalCmdQueue.dropped == 0) && (sequencerRatchetsDropped == 0)
+             && (maxQueued <= AUDIO_CMD_QUEUE_LEN / 4);
+    }
+    printf("late events: %u\n", audioCmdLate);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+/*
+ * this file contains the command queue from the ui/sequencer core to the audio core
+ *
+ * the state of the players and the reverb is only changed by the audio task,
+ * other tasks send commands which are applied at the start of a block or
+ * at the frame given in the command (sample accurate triggers)
+ *
+ * the queue is a wait-free single producer / single consumer ring,
+ * every queue instance must have exactly one writing and one reading task
+ *
+ * the audio clock is also kept here, it converts micros() timestamps into audio frames
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "player.h"
+#include "ml_reverb.h"
+
+enum audioCmdType
+{
+    audio_cmd_sample_on, /* index: sample, lock: step parameters, at frame */
+    audio_cmd_stop_all,
+    audio_cmd_set_pan, /* index: sample, value: pan */
+    audio_cmd_set_vol, /* index: sample, value: vol */
+    audio_cmd_reverb_level, /* level */
+    audio_cmd_midi_start, /* midi realtime messages, frame: micros() of the message */
+    audio_cmd_midi_stop,
+    audio_cmd_midi_clock,
+    audio_cmd_seq_pattern, /* sequencer ring edits, index: ring, value: loop length, pattern */
+    audio_cmd_seq_div, /* index: ring, value: clock divider */
+    audio_cmd_seq_hold, /* index: ring, value: 1 while the button of the ring is pressed */
+    audio_cmd_seq_lock, /* index: ring, value: step, step: locks, frame: micro timing */
+    audio_cmd_seq_clear, /* index: ring, the locks and the micro timing of all steps are removed */
+    audio_cmd_seq_tune, /* index: ring, lock: pitch and fine */
+    audio_cmd_note_on, /* held notes of the sampler, index: slot, note, level: velocity */
+    audio_cmd_note_off, /* note: ch and note */
+    audio_cmd_note_velocity, /* note: ch and note, level: velocity */
+    audio_cmd_note_speed, /* note: ch and note, level: playback speed */
+    audio_cmd_stop_slot, /* index: slot, the voices fade out */
+    audio_cmd_sampler_sync, /* index: slot, the parameters are prepared in samplerSlotSync */
+    audio_cmd_record_start, /* the input is written to the extent prepared in samplerRecorder */
+    audio_cmd_record_stop, /* the length and the peak of the recording are published in samplerRecorder */
+};
+
+struct audio_cmd_s
+{
+    uint32_t frame;
+    uint8_t type;
+    uint8_t index;
+    uint8_t value;
+    float level;
+    union
+    {
+        struct player_lock_s lock; /* audio_cmd_sample_on, audio_cmd_seq_tune */
+        uint64_t pattern; /* audio_cmd_seq_pattern */
+        struct
+        {
+            struct player_lock_s lock;
+            uint8_t probability;
+            uint8_t ratchet;
+        } step; /* audio_cmd_seq_lock */
+        struct
+        {
+            uint8_t ch;
+            uint8_t note;
+            int16_t cents;
+        } note; /* audio_cmd_note_* */
+    };
+};
+
+struct audio_cmd_queue_s
+{
+    struct audio_cmd_s cmd[AUDIO_CMD_QUEUE_LEN];
+    uint32_t write; /* only changed by the producer */
+    uint32_t read; /* only changed by the consumer */
+    uint32_t dropped; /* commands which did not fit into the queue */
+};
+
+/* commands to the audio task */
+struct audio_cmd_queue_s audioCmdQueue;
+
+/* commands created by the audio task itself (sequencer triggers) */
+struct audio_cmd_queue_s audioLocalCmdQueue;
+
+uint32_t audioCmdLate = 0; /* triggers which arrived after their frame was rendered */
+
+/*
+ * audio clock, audioFrame is the first frame of the block which is rendered next
+ * the start of each block is stored with its micros() to convert timestamps into frames
+ * audioClockSeq is odd while the clock is updated
+ */
+uint32_t audioFrame = 0;
+uint32_t audioClockFrame = 0;
+uint32_t audioClockMicros = 0;
+uint32_t audioClockSeq = 0;
+
+/*
+ * producer side, returns false when the queue is full
+ */
+bool AudioCmd_Push(struct audio_cmd_queue_s *queue, const struct audio_cmd_s *cmd)
+{
+    uint32_t write = queue->write;
+    if (write - __atomic_load_n(&queue->read, __ATOMIC_ACQUIRE) >= AUDIO_CMD_QUEUE_LEN)
+    {
+        queue->dropped++;
+        return false;
+    }
+    queue->cmd[write & (AUDIO_CMD_QUEUE_LEN - 1)] = *cmd;
+    __atomic_store_n(&queue->write, write + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * producer side for a queue which is written and read by the same task (audioLocalCmdQueue),
+ * the command is inserted in the order of the frames, triggers can be queued out of order
+ */
+bool AudioCmd_PushSorted(struct audio_cmd_queue_s *queue, const struct audio_cmd_s *cmd)
+{
+    uint32_t write = queue->write;
+    uint32_t pos = write;
+    if (write - queue->read >= AUDIO_CMD_QUEUE_LEN)
+    {
+        queue->dropped++;
+        return false;
+    }
+    while ((pos != queue->read) && ((int32_t)(queue->cmd[(pos - 1) & (AUDIO_CMD_QUEUE_LEN - 1)].frame - cmd->frame) > 0))
+    {
+        queue->cmd[pos & (AUDIO_CMD_QUEUE_LEN - 1)] = queue->cmd[(pos - 1) & (AUDIO_CMD_QUEUE_LEN - 1)];
+        pos--;
+    }
+    queue->cmd[pos & (AUDIO_CMD_QUEUE_LEN - 1)] = *cmd;
+    queue->write = write + 1;
+    return true;
+}
+
+/*
+ * consumer side, returns the oldest command without removing it or NULL when the queue is empty
+ */
+inline struct audio_cmd_s *AudioCmd_Peek(struct audio_cmd_queue_s *queue)
+{
+    uint32_t read = queue->read;
+    if (read == __atomic_load_n(&queue->write, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &queue->cmd[read & (AUDIO_CMD_QUEUE_LEN - 1)];
+}
+
+inline void AudioCmd_Pop(struct audio_cmd_queue_s *queue)
+{
+    __atomic_store_n(&queue->read, queue->read + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * converts a micros() timestamp into an audio frame
+ */
+uint32_t AudioCmd_MicrosToFrame(uint32_t us)
+{
+    uint32_t seq, frame, start;
+    do
+    {
+        seq = __atomic_load_n(&audioClockSeq, __ATOMIC_ACQUIRE);
+        frame = __atomic_load_n(&audioClockFrame, __ATOMIC_RELAXED);
+        start = __atomic_load_n(&audioClockMicros, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while ((seq & 1) || (seq != __atomic_load_n(&audioClockSeq, __ATOMIC_RELAXED)));
+
+    return frame + (int32_t)(((int64_t)(int32_t)(us - start)) * SAMPLE_RATE / 1000000);
+}
+
+uint32_t AudioCmd_FrameNow(void)
+{
+    return AudioCmd_MicrosToFrame(micros());
+}
+
+/*
+ * called by the audio task at the start of every block
+ */
+void AudioCmd_ClockUpdate(void)
+{
+    __atomic_store_n(&audioClockSeq, audioClockSeq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&audioClockFrame, audioFrame, __ATOMIC_RELAXED);
+    __atomic_store_n(&audioClockMicros, (uint32_t)micros(), __ATOMIC_RELAXED);
+    __atomic_store_n(&audioClockSeq, audioClockSeq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * helpers for the producer
+ */
+bool AudioCmd_SampleOn(uint8_t sampleNum, uint32_t frame)
+{
+    struct audio_cmd_s cmd = {frame, audio_cmd_sample_on, sampleNum, 0, 0.0f};
+    return AudioCmd_Push(&audioCmdQueue, &cmd);
+}
+
+bool AudioCmd_StopAll(void)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_stop_all, 0, 0, 0.0f};
+    return AudioCmd_Push(&audioCmdQueue, &cmd);
+}
+
+bool AudioCmd_SetPan(uint8_t sampleNum, uint8_t pan)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_set_pan, sampleNum, pan, 0.0f};
+    return AudioCmd_Push(&audioCmdQueue, &cmd);
+}
+
+bool AudioCmd_SetVol(uint8_t sampleNum, uint8_t vol)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_set_vol, sampleNum, vol, 0.0f};
+    return AudioCmd_Push(&audioCmdQueue, &cmd);
+}
+
+bool AudioCmd_ReverbLevel(float level)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_reverb_level, 0, 0, level};
+    return AudioCmd_Push(&audioCmdQueue, &cmd);
+}
+
+/*
+ * applies all commands of a queue which are due at the given offset of the current block
+ * returns the offset of the next trigger in this block, buffLen if there is none
+ *
+ * the commands are applied in order, a command behind a trigger waits for its frame
+ */
+static int AudioCmd_DispatchQueue(struct audio_cmd_queue_s *queue, int offset, int buffLen)
+{
+    struct audio_cmd_s *cmd;
+    while ((cmd = AudioCmd_Peek(queue)) != NULL)
+    {
+        switch (cmd->type)
+        {
+        case audio_cmd_sample_on:
+            {
+                int32_t due = (int32_t)(cmd->frame - audioFrame);
+                if (due > offset)
+                {
+                    return (due < buffLen) ? due : buffLen;
+                }
+                if (due < offset)
+                {
+                    audioCmdLate++;
+                }
+                playerSampleOn(cmd->index, &cmd->lock);
+            }
+            break;
+        case audio_cmd_stop_all:
+            playerStopAll();
+            break;
+        case audio_cmd_set_pan:
+            playerSetPan(cmd->index, cmd->value);
+            break;
+        case audio_cmd_set_vol:
+            playerSetVol(cmd->index, cmd->value);
+            break;
+        case audio_cmd_reverb_level:
+            Reverb_SetLevel(0, cmd->level);
+            break;
+        }
+        AudioCmd_Pop(queue);
+    }
+    return buffLen;
+}
+
+int AudioCmd_Dispatch(int offset, int buffLen)
+{
+    int next = AudioCmd_DispatchQueue(&audioCmdQueue, offset, buffLen);
+    return min(next, AudioCmd_DispatchQueue(&audioLocalCmdQueue, offset, buffLen));
+}
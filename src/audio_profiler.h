@@ -0,0 +1,186 @@
+/*
+ * this file contains a small profiler for the audio loop
+ *
+ * every stage of audio_task() is measured using the cycle counter (CCOUNT) of the ESP32,
+ * on the host a std::chrono based counter with ns resolution is used instead
+ *
+ * per stage min/avg/max is collected and a histogram of the remaining
+ * deadline margin per block (SAMPLE_BUFFER_SIZE samples) is built
+ * the time waiting in i2s_write is not counted as processing time
+ * the period between the block starts shows the jitter of the audio task
+ *
+ * call Profiler_Dump to print the collected data via Serial
+ * define AUDIO_PROFILER_ENABLED in config.h to enable the profiler
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifndef ARDUINO_ARCH_ESP32
+#include <chrono>
+#endif
+
+enum profilerStage
+{
+    prof_player,
+    prof_reverb,
+    prof_convert,
+    prof_i2s_write,
+    prof_stage_count,
+};
+
+const char *profilerStageNames[prof_stage_count] = {"player", "reverb", "convert", "i2s_write"};
+
+/* 10% per bin, first bin counts blocks which missed the deadline */
+#define PROFILER_HIST_BINS  11
+
+struct profiler_stage_s
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+};
+
+struct profiler_s
+{
+    struct profiler_stage_s stage[prof_stage_count];
+    uint32_t hist[PROFILER_HIST_BINS];
+    uint32_t blocks;
+    uint32_t minMargin;
+    uint32_t missed;
+    uint32_t blockTicks; /* processing time of the current block */
+    uint32_t lastMark;
+    uint32_t blockStart;
+    uint32_t periodMin;
+    uint32_t periodMax;
+};
+
+struct profiler_s profiler;
+
+inline uint32_t Profiler_Ticks(void)
+{
+#ifdef ARDUINO_ARCH_ESP32
+    return ESP.getCycleCount();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline uint32_t Profiler_TicksPerUs(void)
+{
+#ifdef ARDUINO_ARCH_ESP32
+    return getCpuFrequencyMhz();
+#else
+    return 1000;
+#endif
+}
+
+/* time available to process one block */
+inline uint32_t Profiler_Budget(void)
+{
+    return (uint32_t)(((uint64_t)SAMPLE_BUFFER_SIZE) * 1000000 * Profiler_TicksPerUs() / SAMPLE_RATE);
+}
+
+void Profiler_Reset(void)
+{
+    memset(&profiler, 0, sizeof(profiler));
+    for (int i = 0; i < prof_stage_count; i++)
+    {
+        profiler.stage[i].min = UINT32_MAX;
+    }
+    profiler.minMargin = UINT32_MAX;
+    profiler.periodMin = UINT32_MAX;
+}
+
+inline void Profiler_BlockStart(void)
+{
+#ifdef AUDIO_PROFILER_ENABLED
+    uint32_t now = Profiler_Ticks();
+    if (profiler.blockStart != 0)
+    {
+        uint32_t period = now - profiler.blockStart;
+        profiler.periodMin = min(profiler.periodMin, period);
+        profiler.periodMax = max(profiler.periodMax, period);
+    }
+    profiler.blockStart = now;
+    profiler.blockTicks = 0;
+    profiler.lastMark = now;
+#endif
+}
+
+/*
+ * stores the time since the previous mark for the given stage
+ */
+inline void Profiler_StageDone(enum profilerStage stage)
+{
+#ifdef AUDIO_PROFILER_ENABLED
+    uint32_t now = Profiler_Ticks();
+    uint32_t ticks = now - profiler.lastMark;
+    profiler.lastMark = now;
+
+    struct profiler_stage_s *s = &profiler.stage[stage];
+    s->min = min(s->min, ticks);
+    s->max = max(s->max, ticks);
+    s->sum += ticks;
+
+    if (stage != prof_i2s_write)
+    {
+        profiler.blockTicks += ticks;
+    }
+#endif
+}
+
+inline void Profiler_BlockDone(void)
+{
+#ifdef AUDIO_PROFILER_ENABLED
+    uint32_t budget = Profiler_Budget();
+
+    profiler.blocks++;
+    if (profiler.blockTicks >= budget)
+    {
+        profiler.missed++;
+        profiler.minMargin = 0;
+        profiler.hist[0]++;
+    }
+    else
+    {
+        uint32_t margin = budget - profiler.blockTicks;
+        profiler.minMargin = min(profiler.minMargin, margin);
+        profiler.hist[min(1 + (uint32_t)((uint64_t)margin * (PROFILER_HIST_BINS - 1) / budget), (uint32_t)PROFILER_HIST_BINS - 1)]++;
+    }
+#endif
+}
+
+void Profiler_Dump(void)
+{
+    float ticksPerUs = Profiler_TicksPerUs();
+
+    if (profiler.blocks == 0)
+    {
+        Serial.println("Profiler: no data");
+        return;
+    }
+
+    Serial.printf("Profiler: %u blocks, budget %.1f us per block\n", profiler.blocks, Profiler_Budget() / ticksPerUs);
+    for (int i = 0; i < prof_stage_count; i++)
+    {
+        struct profiler_stage_s *s = &profiler.stage[i];
+        Serial.printf("  %-10s min %8.1f us, avg %8.1f us, max %8.1f us\n", profilerStageNames[i],
+                      s->min / ticksPerUs, (s->sum / profiler.blocks) / ticksPerUs, s->max / ticksPerUs);
+    }
+    if (profiler.periodMax > 0)
+    {
+        Serial.printf("  block period min %.1f us, max %.1f us, jitter %.1f us\n", profiler.periodMin / ticksPerUs,
+                      profiler.periodMax / ticksPerUs, (profiler.periodMax - profiler.periodMin) / ticksPerUs);
+    }
+    Serial.printf("  deadline missed: %u, min margin %.1f us\n", profiler.missed, profiler.minMargin / ticksPerUs);
+    Serial.printf("  margin histogram:\n");
+    Serial.printf("    missed : %u\n", profiler.hist[0]);
+    for (int i = 1; i < PROFILER_HIST_BINS; i++)
+    {
+        Serial.printf("    %3d%%..%3d%%: %u\n", (i - 1) * 100 / (PROFILER_HIST_BINS - 1), i * 100 / (PROFILER_HIST_BINS - 1), profiler.hist[i]);
+    }
+
+    Profiler_Reset();
+}
@@ -0,0 +1,105 @@
+/*
+ * this file contains the audio processing chain
+ * it renders one buffer of SAMPLE_BUFFER_SIZE samples per call:
+ * sample players -> effects -> i2s output
+ *
+ * the chain is shared between the firmware and the host tools
+ */
+#pragma once
+
+#include "config.h"
+#include "player.h"
+#include "delay.h"
+#include "ml_reverb.h"
+#include "i2s_interface.h"
+#include "audio_profiler.h"
+#include "audio_command.h"
+#include "sequencer.h"
+
+static float fl_sample[SAMPLE_BUFFER_SIZE];
+static float fr_sample[SAMPLE_BUFFER_SIZE];
+
+#ifdef PLAYER_FIXED_POINT
+static int32_t mix_l[SAMPLE_BUFFER_SIZE];
+static int32_t mix_r[SAMPLE_BUFFER_SIZE];
+#endif
+
+/*
+ * the stages of the chain, separated to allow measuring them
+ *
+ * the players are rendered in pieces split at the frames of the queued triggers,
+ * this starts every trigger exactly at its frame
+ */
+inline void audio_render_players(const int buffLen)
+{
+  AudioCmd_ClockUpdate();
+
+#ifdef PLAYER_FIXED_POINT
+  memset(mix_l, 0, sizeof(mix_l));
+  memset(mix_r, 0, sizeof(mix_r));
+#else
+  memset(fl_sample, 0, sizeof(fl_sample));
+  memset(fr_sample, 0, sizeof(fr_sample));
+#endif
+
+  int start = 0;
+  while (start < buffLen)
+  {
+    int end = AudioCmd_Dispatch(start, buffLen);
+#ifdef PLAYER_FIXED_POINT
+    playerProcessFixed(&mix_l[start], &mix_r[start], end - start);
+#else
+    playerProcess(&fl_sample[start], &fr_sample[start], end - start);
+#endif
+    start = end;
+  }
+  audioFrame += buffLen;
+}
+
+inline void audio_render_effects(const int buffLen)
+{
+#ifdef PLAYER_FIXED_POINT
+  /* the reverb runs in float, its mono input is created like in Reverb_Process */
+  const float toFloat = 1.0f / (1 << PLAYER_MIX_FRAC_BITS);
+  for (int n = 0; n < buffLen; n++)
+  {
+    fl_sample[n] = min(mix_l[n], mix_r[n]) * toFloat;
+  }
+  Reverb_ProcessMono(fl_sample, fr_sample, buffLen);
+  for (int n = 0; n < buffLen; n++)
+  {
+    int32_t wet = fr_sample[n] * (1 << PLAYER_MIX_FRAC_BITS);
+    mix_l[n] += wet;
+    mix_r[n] += wet;
+  }
+#else
+  // Delay_Process_Buff(fl_sample, fr_sample, buffLen);
+  Reverb_Process(fl_sample, fr_sample, buffLen);
+#endif
+}
+
+/* function blocks and returns when sample is put into buffer */
+inline bool audio_output(const int buffLen)
+{
+#ifdef PLAYER_FIXED_POINT
+  return i2s_write_stereo_samples_buff_fixed(mix_l, mix_r, buffLen);
+#else
+  return i2s_write_stereo_samples_buff(fl_sample, fr_sample, buffLen);
+#endif
+}
+
+inline void audio_task()
+{
+  Profiler_BlockStart();
+  sequencerProcess(audioFrame, SAMPLE_BUFFER_SIZE);
+  audio_render_players(SAMPLE_BUFFER_SIZE);
+  Profiler_StageDone(prof_player);
+  audio_render_effects(SAMPLE_BUFFER_SIZE);
+  Profiler_StageDone(prof_reverb);
+
+  if (audio_output(SAMPLE_BUFFER_SIZE))
+  {
+    ; /* nothing for here */
+  }
+  Profiler_BlockDone();
+}
@@ -0,0 +1,104 @@
+/*
+ * this file contains a follower for the MIDI clock (24 pulses per quarter note)
+ *
+ * the pulses arrive with the jitter of the UART and the parsing, a second order PLL
+ * (phase and period filter) estimates the real time of each pulse on the audio timeline:
+ *   error = measured - predicted
+ *   phase = predicted + CLOCK_FOLLOWER_ALPHA * error
+ *   period = period + CLOCK_FOLLOWER_BETA * error
+ *
+ * the filtered pulse times are used to schedule the steps, the measured tempo and
+ * the jitter of the incoming pulses are available for display
+ *
+ * all times are audio frames, the uint32_t frames are unwrapped internally
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+#ifndef CLOCK_FOLLOWER_ALPHA
+#define CLOCK_FOLLOWER_ALPHA    0.1
+#endif
+#ifndef CLOCK_FOLLOWER_BETA
+#define CLOCK_FOLLOWER_BETA     0.005
+#endif
+#define CLOCK_FOLLOWER_PPQN     24
+
+struct clock_follower_s
+{
+    uint32_t pulses; /* pulses since reset */
+    int64_t lastFrame; /* unwrapped frame of the last measured pulse */
+    double phase; /* filtered frame of the last pulse */
+    double period; /* filtered frames per pulse */
+    double jitterRms; /* averaged squared phase error in frames */
+    double jitterMax;
+    uint32_t resyncs; /* pulses which were too far off, the PLL restarted from them */
+};
+
+void ClockFollower_Reset(struct clock_follower_s *cf)
+{
+    memset(cf, 0, sizeof(*cf));
+}
+
+/*
+ * feeds a measured pulse, returns the filtered frame of the pulse
+ */
+uint32_t ClockFollower_Pulse(struct clock_follower_s *cf, uint32_t frame)
+{
+    int64_t measured = (cf->pulses == 0) ? frame : cf->lastFrame + (int32_t)(frame - (uint32_t)cf->lastFrame);
+    cf->lastFrame = measured;
+    cf->pulses++;
+
+    if (cf->pulses == 1)
+    {
+        cf->phase = measured;
+        return frame;
+    }
+    if (cf->pulses == 2)
+    {
+        cf->period = measured - cf->phase;
+        cf->phase = measured;
+        return frame;
+    }
+
+    double predicted = cf->phase + cf->period;
+    double error = measured - predicted;
+
+    if ((error > cf->period) || (error < -cf->period))
+    {
+        /* tempo jump or lost pulses: start again from this pulse */
+        cf->resyncs++;
+        cf->period = max(measured - cf->phase, 1.0);
+        cf->phase = measured;
+        return frame;
+    }
+
+    cf->phase = predicted + CLOCK_FOLLOWER_ALPHA * error;
+    cf->period += CLOCK_FOLLOWER_BETA * error;
+
+    cf->jitterRms += (error * error - cf->jitterRms) / 64;
+    cf->jitterMax = max(cf->jitterMax, (error < 0) ? -error : error);
+
+    return (uint32_t)(int64_t)(cf->phase + 0.5);
+}
+
+float ClockFollower_Bpm(const struct clock_follower_s *cf)
+{
+    if (cf->period <= 0)
+    {
+        return 0.0f;
+    }
+    return (60.0 * SAMPLE_RATE) / (cf->period * CLOCK_FOLLOWER_PPQN);
+}
+
+/* jitter of the incoming pulses in us */
+float ClockFollower_JitterRmsUs(const struct clock_follower_s *cf)
+{
+    return sqrt(cf->jitterRms) * 1000000.0 / SAMPLE_RATE;
+}
+
+float ClockFollower_JitterMaxUs(const struct clock_follower_s *cf)
+{
+    return cf->jitterMax * 1000000.0 / SAMPLE_RATE;
+}
@@ -22,7 +22,19 @@
 #define SAMPLE_SIZE_16BIT
 
 #define AUDIBLE_LIMIT   (0.25f/32768.0f)
+#ifndef NUM_PLAYERS
 #define NUM_PLAYERS 8
+#endif
+#ifndef PLAYER_MAX_VOICES
+#define PLAYER_MAX_VOICES 8 /* voices playing at the same time, defines the max cpu load of the players */
+#endif
+#define PLAYER_STEAL_MODE player_steal_oldest /* see enum playerStealMode */
+#define PLAYER_FADE_LEN (3 * SAMPLE_RATE / 1000) /* frames the previous playback of a retriggered voice fades out (1..5 ms) */
+//#define PLAYER_FADE_EQUAL_POWER /* cos shaped fade out instead of linear */
+#define PLAYER_MAX_TAILS    PLAYER_MAX_VOICES /* fading playbacks at the same time */
+//#define PLAYER_INTERPOLATION_LINEAR /* pitched voices use linear instead of cubic (hermite) interpolation, cheaper but duller */
+#define AUDIO_CMD_QUEUE_LEN  64 /* commands waiting for the audio task, must be a power of 2 */
+#define AUDIO_CMD_LATENCY    (2 * SAMPLE_BUFFER_SIZE) /* triggers are scheduled this many frames ahead to be sample accurate */
 
 #define CHANNEL_COUNT   2
 #define WORD_SIZE   16
@@ -31,7 +43,37 @@
 #define LRCK    (SAMPLE_RATE*CHANNEL_COUNT)
 
 #define ES8388_ENABLED
+#ifndef SAMPLE_BUFFER_SIZE
 #define SAMPLE_BUFFER_SIZE 64
+#endif
+
+/*
+ * mix the sample players in int32 with Q15 gains instead of float
+ * only the reverb is processed in float, the output is saturated once
+ */
+//#define PLAYER_FIXED_POINT
+#define PLAYER_MIX_FRAC_BITS 22 /* fractional bits of the fixed point mix buffers, 1 << 22 is full scale */
+
+/*
+ * samples bigger than PLAYER_STREAM_THRESHOLD bytes (or bigger than the free PSRAM) are streamed from the SD card
+ * only the first PLAYER_STREAM_HEAD_MS are kept in PSRAM, this covers the SD card latency after a trigger
+ * each voice has a ring buffer of PLAYER_STREAM_BUFF_LEN samples which is refilled in halves (must be a power of 2)
+ */
+#define PLAYER_STREAM_THRESHOLD (1024 * 1024)
+#define PLAYER_STREAM_HEAD_MS   250
+#define PLAYER_STREAM_BUFF_LEN  4096
+
+/*
+ * the sample data is kept in an arena in PSRAM (see sample_arena.h), it is created with the first sample
+ * and takes the free PSRAM except SAMPLE_ARENA_RESERVE bytes
+ * the compaction on core 0 copies at most SAMPLE_ARENA_SLICE samples per step
+ */
+#define SAMPLE_ARENA_EXTENTS    32
+#define SAMPLE_ARENA_RESERVE    (64 * 1024)
+#define SAMPLE_ARENA_SLICE      4096
+
+/* measure the stages of the audio loop, send 'p' via serial to print the results */
+#define AUDIO_PROFILER_ENABLED
 
 #define ES8388_PIN_MCLK 0
 #define ES8388_PIN_SCLK 5
@@ -8,6 +8,7 @@
  *
  * Author: Marcel Licence
  */
+#pragma once
 
 
 /* max delay can be changed but changes also the memory consumption */
@@ -1,150 +1,134 @@
+#pragma once
+
 #include "Arduino.h"
 //------------------------- Euclid calculation functions -------------------------------------------//
-//--- the three funcitons below are taken directly from http://clsound.com/euclideansequenc.html ---//
+//--- the bjorklund grouping below follows http://clsound.com/euclideansequenc.html ----------------//
 //--- acknowledgment to Craig Lee ------------------------------------------------------------------//
+//
+// all patterns (length 1..64, 0..length pulses) are calculated at compile time into euclidTable,
+// euclid() is only a table lookup and a rotation and can be called from any task
+// bit n of a pattern is step n
+
+#define EUCLID_MAX_STEPS 64
+
+constexpr uint64_t euclidMask(int pattern_length) {
+  return (pattern_length >= 64) ? ~0ULL : ((1ULL << pattern_length) - 1);
+}
 
 //------------Function to right rotate n by d bits---------------------------------//
-uint16_t rightRotate(int shift, uint16_t value, uint8_t pattern_length) {
-  uint16_t mask = ((1 << pattern_length) - 1);
-  value &= mask;
-  return ((value >> shift) | (value << (pattern_length - shift))) & mask;
+constexpr uint64_t rightRotate(int shift, uint64_t value, uint8_t pattern_length) {
+  return (shift == 0) ? (value & euclidMask(pattern_length))
+         : ((((value & euclidMask(pattern_length)) >> shift) | ((value & euclidMask(pattern_length)) << (pattern_length - shift))) & euclidMask(pattern_length));
 }
 
-//----1---------Function to find the binary length of a number by counting bitwise-------//
-int findlength(unsigned int bnry) {
-  bool lengthfound = false;
-  int length = 1; // no number can have a length of zero - single 0 has a length of one, but no 1s for the sytem to count
-  for (int q = 32; q >= 0; q--) {
-    int r = bitRead(bnry, q);
-    if (r == 1 && lengthfound == false) {
-      length = q + 1;
-      lengthfound = true;
+//----1---------Function to find the binary length of a number-------//
+// binary search, a bit by bit scan of 64 bits makes the table too expensive for the compiler
+constexpr int findlength(uint64_t bnry) {
+  int length = 1; // no number can have a length of zero - single 0 has a length of one
+  for (int q = 32; q > 0; q >>= 1) {
+    if (bnry >> q) {
+      bnry >>= q;
+      length += q;
     }
   }
   return length;
 }
 
 //-----2--------Function to concatenate two binary numbers bitwise----------------------//
-unsigned int ConcatBin(unsigned int bina, unsigned int binb) {
-  int binb_len = findlength(binb);
-  unsigned int sum = (bina << binb_len);
-  sum = sum | binb;
-  return sum;
+constexpr uint64_t ConcatBin(uint64_t bina, uint64_t binb) {
+  return (findlength(binb) >= 64) ? binb : ((bina << findlength(binb)) | binb); // a full 64 bit binb leaves no room for bina
 }
 
 //------3-------------------Euclidean bit sorting funciton-------------------------------//
-unsigned int euclid(int n, int k, int o) { // inputs: n=total, k=beats, o = offset
+constexpr uint64_t euclidPattern(int n, int k) { // inputs: n=total, k=beats
+  if (k == 0) {
+    return 0;
+  }
+
   int pauses = n - k;
   int pulses = k;
-  int offset = o;
-  int steps = n;
   int per_pulse = pauses / k;
   int remainder = pauses % pulses;
-  unsigned int workbeat[n];
-  unsigned int outbeat;
-  uint16_t outbeat2;
+  uint64_t workbeat[EUCLID_MAX_STEPS] = {};
+  uint64_t outbeat = 0;
   int workbeat_count = n;
-  int a;
-  int b;
-  int trim_count;
 
-  for (a = 0; a < n; a++) { // Populate workbeat with unsorted pulses and pauses
-    if (a < pulses) {
-      workbeat[a] = 1;
-    }
-    else {
-      workbeat[a] = 0;
-    }
+  for (int a = 0; a < n; a++) { // Populate workbeat with unsorted pulses and pauses
+    workbeat[a] = (a < pulses) ? 1 : 0;
   }
 
   if (per_pulse > 0 && remainder < 2) { // Handle easy cases where there is no or only one remainer
-    for (a = 0; a < pulses; a++) {
-      for (b = workbeat_count - 1; b > workbeat_count - per_pulse - 1; b--) {
+    for (int a = 0; a < pulses; a++) {
+      for (int b = workbeat_count - 1; b > workbeat_count - per_pulse - 1; b--) {
         workbeat[a] = ConcatBin(workbeat[a], workbeat[b]);
       }
       workbeat_count = workbeat_count - per_pulse;
     }
-
-    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count
-    for (a = 0; a < workbeat_count; a++) {
-      outbeat = ConcatBin(outbeat, workbeat[a]);
-    }
-
-    if (offset > 0) {
-      outbeat2 = rightRotate(offset, outbeat, steps); // Add offset to the step pattern
-    }
-    else {
-      outbeat2 = outbeat;
-    }
-
-    return outbeat2;
   }
-
   else {
-    if (pulses == 0) {
-      pulses = 1;  // Prevent crashes when k=0 and n goes from 0 to 1
-    }
     int groupa = pulses;
     int groupb = pauses;
-    int iteration = 0;
-    if (groupb <= 1) {
-    }
 
     while (groupb > 1) { //main recursive loop
-      
+      int trim_count = 0;
+
       if (groupa > groupb) { // more Group A than Group B
         int a_remainder = groupa - groupb; // what will be left of groupa once groupB is interleaved
-        trim_count = 0;
-        for (a = 0; a < groupa - a_remainder; a++) { //count through the matching sets of A, ignoring remaindered
+        for (int a = 0; a < groupa - a_remainder; a++) { //count through the matching sets of A, ignoring remaindered
           workbeat[a] = ConcatBin(workbeat[a], workbeat[workbeat_count - 1 - a]);
           trim_count++;
         }
-        workbeat_count = workbeat_count - trim_count;
-
         groupa = groupb;
         groupb = a_remainder;
       }
-
       else if (groupb > groupa) { // More Group B than Group A
         int b_remainder = groupb - groupa; // what will be left of group once group A is interleaved
-        trim_count = 0;
-        for (a = workbeat_count - 1; a >= groupa + b_remainder; a--) { //count from right back through the Bs
+        for (int a = workbeat_count - 1; a >= groupa + b_remainder; a--) { //count from right back through the Bs
           workbeat[workbeat_count - a - 1] = ConcatBin(workbeat[workbeat_count - a - 1], workbeat[a]);
-
           trim_count++;
         }
-        workbeat_count = workbeat_count - trim_count;
         groupb = b_remainder;
       }
-
-      else if (groupa == groupb) { // groupa = groupb
-        trim_count = 0;
-        for (a = 0; a < groupa; a++) {
+      else { // groupa = groupb
+        for (int a = 0; a < groupa; a++) {
           workbeat[a] = ConcatBin(workbeat[a], workbeat[workbeat_count - 1 - a]);
           trim_count++;
         }
-        workbeat_count = workbeat_count - trim_count;
         groupb = 0;
       }
-
-      else {
-        //Serial.println("ERROR");
-      }
-      iteration++;
+      workbeat_count = workbeat_count - trim_count;
     }
+  }
 
-    outbeat = 0; // Concatenate workbeat into outbeat - according to workbeat_count
-    for (a = 0; a < workbeat_count; a++) {
-      outbeat = ConcatBin(outbeat, workbeat[a]);
-    }
+  for (int a = 0; a < workbeat_count; a++) { // Concatenate workbeat into outbeat - according to workbeat_count
+    outbeat = ConcatBin(outbeat, workbeat[a]);
+  }
+  return outbeat;
+}
 
-    if (offset > 0) {
-      outbeat2 = rightRotate(offset, outbeat, steps); // Add offset to the step pattern
-    }
-    else {
-      outbeat2 = outbeat;
-    }
+//------4-------------------table of all patterns without offset-------------------------//
+// triangular layout: length n starts at n * (n + 1) / 2 - 1 and has n + 1 entries (0..n pulses)
+#define EUCLID_TABLE_INDEX(n, k) ((n) * ((n) + 1) / 2 - 1 + (k))
+#define EUCLID_TABLE_SIZE EUCLID_TABLE_INDEX(EUCLID_MAX_STEPS + 1, 0)
 
-    return outbeat2;
+struct euclid_table_s {
+  uint64_t pattern[EUCLID_TABLE_SIZE];
+};
+
+constexpr euclid_table_s euclidMakeTable() {
+  euclid_table_s table = {};
+  for (int n = 1; n <= EUCLID_MAX_STEPS; n++) {
+    for (int k = 0; k <= n; k++) {
+      table.pattern[EUCLID_TABLE_INDEX(n, k)] = euclidPattern(n, k);
+    }
   }
-}
\ No newline at end of file
+  return table;
+}
+
+constexpr euclid_table_s euclidTable = euclidMakeTable();
+
+//------5-------------------pattern with offset-------------------------------------------//
+inline uint64_t euclid(int n, int k, int o) { // inputs: n=total, k=beats, o = offset
+  uint64_t outbeat = euclidTable.pattern[EUCLID_TABLE_INDEX(n, k)];
+  return (o > 0) ? rightRotate(o, outbeat, n) : outbeat;
+}
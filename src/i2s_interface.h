@@ -4,6 +4,7 @@
  *
  * Author: Marcel Licence
  */
+#pragma once
 
 #ifdef __CDT_PARSER__
 #include <cdt.h>
@@ -11,6 +12,8 @@
 
 #include <driver/i2s.h>
 
+#include "audio_profiler.h"
+
 /*
  * no dac not tested within this code
  * - it has the purpose to generate a quasy analog signal without a DAC
@@ -92,8 +95,10 @@ bool i2s_write_stereo_samples_buff(float *fl_sample, float *fr_sample, const int
 
     static size_t bytes_written = 0;
 
+    Profiler_StageDone(prof_convert);
     if(i2s_write(i2s_port_number, (const char *)&sampleDataU[0].sample, 4 * buffLen, &bytes_written, portMAX_DELAY) != ESP_OK)
         Serial.println("i2s write error!");
+    Profiler_StageDone(prof_i2s_write);
 
     if (bytes_written > 0)
     {
@@ -105,6 +110,44 @@ bool i2s_write_stereo_samples_buff(float *fl_sample, float *fr_sample, const int
     }
 }
 
+#ifdef PLAYER_FIXED_POINT
+static inline int16_t i2s_saturate(int32_t value)
+{
+    return (value > INT16_MAX) ? INT16_MAX : ((value < INT16_MIN) ? INT16_MIN : value);
+}
+
+/*
+ * same as i2s_write_stereo_samples_buff but takes the fixed point mix buffers
+ * the output has the same scaling as the float version and is saturated
+ */
+bool i2s_write_stereo_samples_buff_fixed(const int32_t *mix_l, const int32_t *mix_r, const int buffLen)
+{
+    static union sampleTUNT
+    {
+        uint32_t sample;
+        int16_t ch[2];
+    } sampleDataU[SAMPLE_BUFFER_SIZE];
+
+    for (int n = 0; n < buffLen; n++)
+    {
+        /*
+         * using RIGHT_LEFT format
+         */
+        sampleDataU[n].ch[0] = i2s_saturate(mix_l[n] >> (PLAYER_MIX_FRAC_BITS - 14)); /* some bits missing here */
+        sampleDataU[n].ch[1] = i2s_saturate(mix_r[n] >> (PLAYER_MIX_FRAC_BITS - 14));
+    }
+
+    static size_t bytes_written = 0;
+
+    Profiler_StageDone(prof_convert);
+    if(i2s_write(i2s_port_number, (const char *)&sampleDataU[0].sample, 4 * buffLen, &bytes_written, portMAX_DELAY) != ESP_OK)
+        Serial.println("i2s write error!");
+    Profiler_StageDone(prof_i2s_write);
+
+    return bytes_written > 0;
+}
+#endif
+
 void i2s_read_stereo_samples(float *fl_sample, float *fr_sample)
 {
     static size_t bytes_read = 0;
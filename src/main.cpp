@@ -5,7 +5,6 @@
 #include <RotaryEncOverMCP.h>
 #include <WiFi.h>
 #include <Wire.h>
-#include <MIDI.h>
 
 #include "config.h"
 #include "Hardware.h"
@@ -19,45 +18,22 @@
 #include "es8388.h"
 #include "delay.h"
 #include "ml_reverb.h"
-
-unsigned long newTime;
-unsigned long oldTime;
-unsigned long INTERVAL; //micros
+#include "audio_task.h"
+#include "sequencer.h"
+#include "midi_uart.h"
 
 TwoWire I2C1 = TwoWire(0); //I2C1 bus
 TwoWire I2C2 = TwoWire(1); //I2C2 bus
 
 TaskHandle_t Core0TaskHnd;
-
-// MIDI stuff
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, serialMidi);
+TaskHandle_t AudioTaskHnd;
 
 #ifndef absf
 #define absf(a) ((a >= 0.0f) ? (a) : (-a))
 #endif
 
-static float fl_sample[SAMPLE_BUFFER_SIZE];
-static float fr_sample[SAMPLE_BUFFER_SIZE];
-
-inline void audio_task()
-{
-  memset(fl_sample, 0, sizeof(fl_sample));
-  memset(fr_sample, 0, sizeof(fr_sample));
-
-  playerProcess(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
-  // Delay_Process_Buff(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
-  Reverb_Process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
-
-  /* function blocks and returns when sample is put into buffer */
-  if (i2s_write_stereo_samples_buff(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE))
-  {
-    ; /* nothing for here */
-  }
-}
-
 #define DEBUG
 
-#define RINGS 4
 #define RINGPIX 16
 
 #define NUMPIXELS RINGS *RINGPIX // Popular NeoPixel ring size
@@ -69,28 +45,9 @@ byte numModes = 3;
   2 = offset edit,
 */
 
-const uint8_t divRatio[5] = {16, 8, 4, 2, 1}; //note multipliers = "1","2","4","8","16","32"
-
 int channel_settings = -1;
 uint8_t reverbLevel = 3;
 
-struct ringState
-{
-  byte mode;
-  int8_t activeNote;
-  byte loopLength;
-  byte numNotes;
-  byte offset;
-  int8_t clkDiv;
-  uint16_t userNotes;
-  uint16_t euclidNotes;
-  int8_t panValue;
-  int8_t vol;
-};
-
-ringState ringStates[RINGS];
-bool buttonState[RINGS]; // black buttons below
-
 // encoder state stuff
 unsigned long lastTransition[RINGS];
 
@@ -120,21 +77,26 @@ void updatePixels()
     uint8_t i, j;
     for (i = 0; i < 4; i++)
     {
-      for (j = 0; j < ringStates[i].loopLength; j++)
+      // patterns longer than the ring are shown in pages of RINGPIX steps, the page follows the active step
+      // the active step is the only state read back from the sequencer
+      int8_t activeNote = __atomic_load_n(&sequencerRings[i].activeNote, __ATOMIC_RELAXED);
+      uint8_t first = (activeNote / RINGPIX) * RINGPIX;
+      uint8_t last = min(ringStates[i].loopLength, (uint8_t)(first + RINGPIX));
+      for (j = first; j < last; j++)
       {
         if (bitRead(ringStates[i].euclidNotes, j))
         {
-          if (ringStates[i].activeNote == j)
-            getPixColor(i, j, true, 4);
+          if (activeNote == j)
+            getPixColor(i, j - first, true, 4);
           else
-            getPixColor(i, j, true, ringStates[i].mode);
+            getPixColor(i, j - first, true, ringStates[i].mode);
         }
         else
         {
-          if (ringStates[i].activeNote == j)
-            getPixColor(i, j, false, 4);
+          if (activeNote == j)
+            getPixColor(i, j - first, false, 4);
           else
-            getPixColor(i, j, false, ringStates[i].mode);
+            getPixColor(i, j - first, false, ringStates[i].mode);
         }
       }
     }
@@ -190,79 +152,10 @@ void updatePixels()
   pixels.show();
 }
 
-const uint8_t max_div = 16;
-uint8_t seq_counter = 1;
-
-
-volatile bool midi_clock = false;
-volatile uint8_t bpm = 120;
-uint8_t pulse_counter = 0;
-
-
-void sequencerTick()
-{
-  for (int i = 0; i < RINGS; i++)
-  {
-    if (seq_counter % divRatio[ringStates[i].clkDiv] == 0)
-    {
-      if (ringStates[i].activeNote + 1 >= ringStates[i].loopLength)
-        ringStates[i].activeNote = 0;
-      else
-        ringStates[i].activeNote += 1;
-
-      if (bitRead(ringStates[i].euclidNotes, ringStates[i].activeNote) || buttonState[i])
-      {
-        playerSampleOn(i);
-      }
-      updatePixels();
-    }
-  }
-  if ((seq_counter + 1) > max_div)
-    seq_counter = 1;
-  else
-    seq_counter += 1;
-}
-
-void startHandler()
-{
-  midi_clock = true;
-  seq_counter = 1;
-  for (int i = 0; i < RINGS; i++)
-  {
-    ringStates[i].activeNote = 0;
-  }
-  pulse_counter = 0;
-  sequencerTick();
-  Serial.println("clk start");
-}
-
-void stopHandler()
-{
-  midi_clock = false;
-  pulse_counter = 0;
-  Serial.println("clk stop");
-}
-
-void clockHandler()
-{
-  if (midi_clock)
-  {
-    pulse_counter++;
-    if (! (pulse_counter % 3))
-    {
-      sequencerTick();
-    }
-    if (pulse_counter > 23) {
-      pulse_counter = 0;
-    }
-  }
-}
-
 void rotaryEncoderChanged(bool clockwise, int id)
 {
   if(channel_settings == -1)
   {
-    bool recalcEuclid = true;
     switch (ringStates[id].mode)
     {
       case 0: // numNotes
@@ -281,9 +174,11 @@ void rotaryEncoderChanged(bool clockwise, int id)
 
       case 2: // length edit
         if (clockwise)
-          ringStates[id].loopLength = constrain(ringStates[id].loopLength + 1, 1, RINGPIX);
+          ringStates[id].loopLength = constrain(ringStates[id].loopLength + 1, 1, SEQ_MAX_STEPS);
         else
-          ringStates[id].loopLength = constrain(ringStates[id].loopLength - 1, 1, RINGPIX);
+          ringStates[id].loopLength = constrain(ringStates[id].loopLength - 1, 1, SEQ_MAX_STEPS);
+        ringStates[id].numNotes = min(ringStates[id].numNotes, ringStates[id].loopLength);
+        ringStates[id].offset = min(ringStates[id].offset, (byte)(ringStates[id].loopLength - 1));
         break;
       default:
         break;
@@ -293,6 +188,7 @@ void rotaryEncoderChanged(bool clockwise, int id)
       ringStates[id].euclidNotes = euclid(ringStates[id].loopLength, ringStates[id].numNotes, ringStates[id].offset);
     else
       ringStates[id].euclidNotes = 0;
+    sequencerSendPattern(id, ringStates[id].loopLength, ringStates[id].euclidNotes);
   }
   else
   {
@@ -307,18 +203,19 @@ void rotaryEncoderChanged(bool clockwise, int id)
       {
         ringStates[channel_settings].clkDiv = constrain(ringStates[channel_settings].clkDiv - 1, 0, 4);
       }
+      sequencerSendDiv(channel_settings, ringStates[channel_settings].clkDiv);
       break;
 
     case 1: // pan
       if (clockwise)
       {
         ringStates[channel_settings].panValue = constrain(ringStates[channel_settings].panValue + 1, 0, 18);
-        playerSetPan(channel_settings, ringStates[channel_settings].panValue);
+        AudioCmd_SetPan(channel_settings, ringStates[channel_settings].panValue);
       }
       else
       {
         ringStates[channel_settings].panValue = constrain(ringStates[channel_settings].panValue - 1, 0, 18);
-        playerSetPan(channel_settings, ringStates[channel_settings].panValue);
+        AudioCmd_SetPan(channel_settings, ringStates[channel_settings].panValue);
       }
       break;
 
@@ -326,12 +223,12 @@ void rotaryEncoderChanged(bool clockwise, int id)
       if (clockwise)
       {
         ringStates[channel_settings].vol = constrain(ringStates[channel_settings].vol + 1, 0, 16);
-        playerSetVol(channel_settings, ringStates[channel_settings].vol);
+        AudioCmd_SetVol(channel_settings, ringStates[channel_settings].vol);
       }
       else
       {
         ringStates[channel_settings].vol = constrain(ringStates[channel_settings].vol - 1, 0, 16);
-        playerSetVol(channel_settings, ringStates[channel_settings].vol);
+        AudioCmd_SetVol(channel_settings, ringStates[channel_settings].vol);
       }
       break;
 
@@ -339,12 +236,12 @@ void rotaryEncoderChanged(bool clockwise, int id)
       if (clockwise)
       {
         reverbLevel = constrain(reverbLevel + 1, 0, 16);
-        Reverb_SetLevel(0, (float)reverbLevel / 16);
+        AudioCmd_ReverbLevel((float)reverbLevel / 16);
       }
       else
       {
         reverbLevel = constrain(reverbLevel - 1, 0, 16);
-        Reverb_SetLevel(0, (float)reverbLevel / 16);
+        AudioCmd_ReverbLevel((float)reverbLevel / 16);
       }
       break;
     
@@ -438,14 +335,7 @@ void buttonChanged(Button *btn, bool released, bool longPress)
   }
   else if (btn->id <= 7)
   {
-    if (!released)
-    {
-      buttonState[btn->id - 4] = true;
-    }
-    else
-    {
-      buttonState[btn->id - 4] = false;
-    }
+    sequencerSendHold(btn->id - 4, !released);
   }
 }
 
@@ -467,23 +357,23 @@ void initAnimation()
 }
 inline void Core0TaskSetup()
 {
-  newTime = micros(); //start the bpm timer clock
   initRotaryEncoders();
 }
 
+/*
+ * the sequencer runs in the audio task, the pixels are only updated when it moved on
+ * the stream buffers are refilled and the sample arena is compacted here, below the audio task
+ */
 inline void Core0TaskLoop()
 {
-  updatePixels();
-  pollMCP();
-  if (! midi_clock)
+  if (sequencerStepChanged)
   {
-    INTERVAL = 15000000 / (bpm);
-    if ((micros() - oldTime) > INTERVAL)
-    {
-      oldTime = micros();
-      sequencerTick();
-    }
+    sequencerStepChanged = false;
+    updatePixels();
   }
+  pollMCP();
+  playerStreamService();
+  playerArenaService();
 }
 
 void CoreTask0(void *parameter)
@@ -502,11 +392,19 @@ void CoreTask0(void *parameter)
 void midiInit()
 {
   // MIDI stuff
-  Serial1.begin(31250, SERIAL_8N1, 34, 0);
-  serialMidi.setHandleClock(clockHandler);
-  serialMidi.setHandleStop(stopHandler);
-  serialMidi.setHandleStart(startHandler);
-  serialMidi.begin(MIDI_CHANNEL_OMNI);
+  MidiUart_Init(34, &midiCmdQueue, configMAX_PRIORITIES - 2);
+}
+
+/*
+ * the audio runs in its own task with the highest priority on core 1
+ * i2s_write blocks until the DMA has space for the next block, this paces the task
+ */
+void AudioTask(void *parameter)
+{
+  while (true)
+  {
+    audio_task();
+  }
 }
 
 void setup()
@@ -531,6 +429,7 @@ void setup()
   btStop();
 #endif
   playerInit();
+  Profiler_Reset();
   static float *revBuffer = (float *)malloc(sizeof(float) * REV_BUFF_SIZE);
   Reverb_Setup(revBuffer);
   Reverb_SetLevel(0, 0.2f);
@@ -557,12 +456,27 @@ void setup()
     ringStates[i].clkDiv = 2;
     ringStates[i].panValue = 9;
     ringStates[i].vol = 16;
+    sequencerSendPattern(i, ringStates[i].loopLength, ringStates[i].euclidNotes);
+    sequencerSendDiv(i, ringStates[i].clkDiv);
   }
-  xTaskCreatePinnedToCore(CoreTask0, "CoreTask0", 8192, NULL, 999, &Core0TaskHnd, 0);
+  /* the slots are not loaded anymore once the audio task plays them */
+  playerLockSlots();
+  /* ui and sequencer run below the midi task, so midi messages are timestamped without delay */
+  xTaskCreatePinnedToCore(CoreTask0, "CoreTask0", 8192, NULL, 1, &Core0TaskHnd, 0);
+  xTaskCreatePinnedToCore(AudioTask, "AudioTask", 8192, NULL, configMAX_PRIORITIES - 1, &AudioTaskHnd, 1);
 }
 
 void loop()
 {
-  audio_task();
-  serialMidi.read();
+  delay(10);
+
+  if (Serial.available() && (Serial.read() == 'p'))
+  {
+    Profiler_Dump();
+    Serial.printf("Stream underruns: %u blocks, %u samples\n", playerStreamUnderruns, playerStreamUnderrunSamples);
+    Serial.printf("Sample arena: %u samples free, %u in the biggest extent, %u moves\n", SampleArena_FreeTotal(), SampleArena_FreeMax(), sampleArena.moves);
+    Serial.printf("MIDI overflows: %u, late triggers: %u\n", __atomic_load_n(&midiUartOverflows, __ATOMIC_RELAXED), audioCmdLate);
+    Serial.printf("MIDI clock: %.2f bpm, jitter %.1f us rms, %.1f us max, %u resyncs\n", ClockFollower_Bpm(&midiClockFollower),
+                  ClockFollower_JitterRmsUs(&midiClockFollower), ClockFollower_JitterMaxUs(&midiClockFollower), midiClockFollower.resyncs);
+  }
 }
@@ -0,0 +1,117 @@
+/*
+ * this file contains the DIN MIDI input
+ *
+ * the UART is read by its own task which waits for the events of the UART driver,
+ * this keeps the parsing away from the audio task
+ * every message gets the micros() of its arrival, corrected by the time of the bytes received after it
+ *
+ * only the realtime messages start/stop/clock are used by the sequencer,
+ * they are passed to the sequencer task via a command queue
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include "audio_command.h"
+
+#define MIDI_UART_NUM       UART_NUM_1
+#define MIDI_UART_BAUD      31250
+#define MIDI_UART_RX_BUFF   256
+#define MIDI_BYTE_US        (10 * 1000000 / MIDI_UART_BAUD) /* 320 us per byte */
+
+static QueueHandle_t midiUartQueue;
+static struct audio_cmd_queue_s *midiUartCmdQueue;
+
+uint32_t midiUartOverflows = 0; /* only written by the midi task, read with __atomic_load_n */
+
+static void MidiUart_Byte(uint8_t data, uint32_t timestamp)
+{
+    struct audio_cmd_s cmd = {timestamp, 0, 0, 0, 0.0f};
+
+    switch (data)
+    {
+    case 0xF8:
+        cmd.type = audio_cmd_midi_clock;
+        break;
+    case 0xFA:
+        cmd.type = audio_cmd_midi_start;
+        break;
+    case 0xFC:
+        cmd.type = audio_cmd_midi_stop;
+        break;
+    default:
+        return; /* other messages are not used */
+    }
+    AudioCmd_Push(midiUartCmdQueue, &cmd);
+}
+
+static void MidiUart_Task(void *parameter)
+{
+    uart_event_t event;
+    uint8_t data[MIDI_UART_RX_BUFF];
+
+    while (true)
+    {
+        if (xQueueReceive(midiUartQueue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        switch (event.type)
+        {
+        case UART_DATA:
+            {
+                uint32_t now = micros();
+                int len = uart_read_bytes(MIDI_UART_NUM, data, min(event.size, sizeof(data)), 0);
+                for (int i = 0; i < len; i++)
+                {
+                    /* the last byte arrived now, the ones before one byte time earlier each */
+                    MidiUart_Byte(data[i], now - (len - 1 - i) * MIDI_BYTE_US);
+                }
+            }
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            __atomic_store_n(&midiUartOverflows, midiUartOverflows + 1, __ATOMIC_RELAXED);
+            uart_flush_input(MIDI_UART_NUM);
+            xQueueReset(midiUartQueue);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * the task runs on core 0 next to the ui, the audio task on core 1 with the sequencer is not disturbed
+ */
+void MidiUart_Init(int rxPin, struct audio_cmd_queue_s *cmdQueue, UBaseType_t priority)
+{
+    uart_config_t uart_config =
+    {
+        .baud_rate = MIDI_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = 0,
+    };
+
+    midiUartCmdQueue = cmdQueue;
+
+    uart_param_config(MIDI_UART_NUM, &uart_config);
+    uart_set_pin(MIDI_UART_NUM, UART_PIN_NO_CHANGE, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_driver_install(MIDI_UART_NUM, MIDI_UART_RX_BUFF * 2, 0, 16, &midiUartQueue, 0);
+
+    /* an event for every byte, messages are timestamped when they arrive */
+    uart_intr_config_t intr_config =
+    {
+        .intr_enable_mask = UART_RXFIFO_FULL_INT_ENA_M | UART_RXFIFO_TOUT_INT_ENA_M,
+        .rx_timeout_thresh = 1,
+        .txfifo_empty_intr_thresh = 10,
+        .rxfifo_full_thresh = 1,
+    };
+    uart_intr_config(MIDI_UART_NUM, &intr_config);
+
+    xTaskCreatePinnedToCore(MidiUart_Task, "MidiUart", 4096, NULL, priority, NULL, 0);
+}
@@ -170,6 +170,32 @@ static void Do_Allpass(struct allpass_s *ap, float *inSample, int buffLen)
     }
 }
 
+/*
+ * processes a mono input signal and writes the wet signal (including level) to outSample
+ */
+void Reverb_ProcessMono(const float *inSample, float *outSample, int buffLen)
+{
+    memset(outSample, 0, sizeof(float) * buffLen);
+    Do_Comb(&cf0, inSample, outSample, buffLen);
+    Do_Comb(&cf1, inSample, outSample, buffLen);
+    Do_Comb(&cf2, inSample, outSample, buffLen);
+    Do_Comb(&cf3, inSample, outSample, buffLen);
+    for (int n = 0; n < buffLen; n++)
+    {
+        outSample[n] *= 0.25f;
+    }
+
+    Do_Allpass(&ap0, outSample, buffLen);
+    Do_Allpass(&ap1, outSample, buffLen);
+    Do_Allpass(&ap2, outSample, buffLen);
+
+    /* apply reverb level */
+    for (int n = 0; n < buffLen; n++)
+    {
+        outSample[n] *= rev_level;
+    }
+}
+
 void Reverb_Process(float *signal_l, float *signal_r, int buffLen)
 {
     float inSample[buffLen];
@@ -183,24 +209,10 @@ void Reverb_Process(float *signal_l, float *signal_r, int buffLen)
             inSample[n] = signal_r[n];        
     }
     float newsample[buffLen];
-    memset(newsample, 0, sizeof(newsample));
-    Do_Comb(&cf0, inSample, newsample, buffLen);
-    Do_Comb(&cf1, inSample, newsample, buffLen);
-    Do_Comb(&cf2, inSample, newsample, buffLen);
-    Do_Comb(&cf3, inSample, newsample, buffLen);
-    for (int n = 0; n < buffLen; n++)
-    {
-        newsample[n] *= 0.25f;
-    }
+    Reverb_ProcessMono(inSample, newsample, buffLen);
 
-    Do_Allpass(&ap0, newsample, buffLen);
-    Do_Allpass(&ap1, newsample, buffLen);
-    Do_Allpass(&ap2, newsample, buffLen);
-
-    /* apply reverb level */
     for (int n = 0; n < buffLen; n++)
     {
-        newsample[n] *= rev_level;
         signal_l[n] += newsample[n];
         signal_r[n] += newsample[n];
     }
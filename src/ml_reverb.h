@@ -63,6 +63,7 @@
 
 
 void Reverb_Process(float *signal_l, float *signal_r, int buffLen);
+void Reverb_ProcessMono(const float *inSample, float *outSample, int buffLen);
 void Reverb_Setup(float *buffer);
 void Reverb_SetLevel(uint8_t not_used, float value);
 
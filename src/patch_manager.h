@@ -43,6 +43,11 @@ struct patchParamV1_s
     float release;
 };
 
+struct patchParamV2_s
+{
+    float gain; /* playback level of the sample data (normalization) */
+};
+
 struct patchParam_s
 {
     union
@@ -53,6 +58,7 @@ struct patchParam_s
 
             struct patchParamV0_s patchParamV0;
             struct patchParamV1_s patchParamV1;
+            struct patchParamV2_s patchParamV2;
 
         };
         uint8_t buffer[512]; /*! raw data */
@@ -507,6 +513,68 @@ uint32_t PatchManager_LoadWavefile(fs::FS &fs, char *filename, int16_t *buffer,
     return bufferIn / sizeof(int16_t);
 }
 
+/*
+ * opens a wav file for streaming, the file is left at the start of the sample data
+ * returns the number of samples per channel, 0 when the file can not be streamed
+ */
+uint32_t PatchManager_OpenWavStream(fs::FS &fs, char *filename, File &f, uint16_t *channels)
+{
+    f = fs.open(filename, FILE_READ);
+    if (!f)
+    {
+        Serial.println("Could not read file\n");
+        return 0;
+    }
+
+    union wavHeader wavHeader;
+
+    memset(wavHeader.wavHdr, 0, sizeof(wavHeader));
+
+    f.seek(0, SeekSet);
+    f.read(wavHeader.wavHdr, 44);
+
+    if ((wavHeader.format_tag != 1) || (wavHeader.bitsPerSample != 16) || (wavHeader.sampleRate != 44100)
+        || (wavHeader.numberOfChannels < 1) || (wavHeader.numberOfChannels > 2))
+    {
+        f.close();
+        return 0;
+    }
+
+    *channels = wavHeader.numberOfChannels;
+    return wavHeader.dataSize / (sizeof(int16_t) * wavHeader.numberOfChannels);
+}
+
+/*
+ * reads samples from the current position of a wav file opened with PatchManager_OpenWavStream
+ * only the left channel of stereo files is used
+ */
+uint32_t PatchManager_ReadWavSamples(File &f, uint16_t channels, int16_t *buffer, uint32_t numSamples)
+{
+    if (channels == 1)
+    {
+        return f.read((uint8_t *)buffer, numSamples * sizeof(int16_t)) / sizeof(int16_t);
+    }
+
+    uint32_t samplesIn = 0;
+    while (samplesIn < numSamples)
+    {
+        int16_t tempBuffer[256];
+        uint32_t frames = min(numSamples - samplesIn, (uint32_t)(sizeof(tempBuffer) / (2 * sizeof(int16_t))));
+        uint32_t framesRead = f.read((uint8_t *)tempBuffer, frames * 2 * sizeof(int16_t)) / (2 * sizeof(int16_t));
+
+        for (uint32_t i = 0; i < framesRead; i++)
+        {
+            buffer[samplesIn++] = tempBuffer[2 * i];
+        }
+
+        if (framesRead < frames)
+        {
+            break;
+        }
+    }
+    return samplesIn;
+}
+
 void PatchManager_CreateDir(fs::FS &fs, const char *path)
 {
     Serial.printf("Creating Dir: %s\n", path);
@@ -564,6 +632,10 @@ void PatchManager_LoadPatchParam(fs::FS &fs, char *filename, struct patchParam_s
         Serial.printf("        sustain: %0.06f\n", patchParam->patchParamV1.sustain);
         Serial.printf("        release: %0.06f\n", patchParam->patchParamV1.release);
     }
+    if (patchParam->version >= 2)
+    {
+        Serial.printf("        gain: %0.06f\n", patchParam->patchParamV2.gain);
+    }
 #endif
 
     f.close();
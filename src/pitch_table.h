@@ -0,0 +1,133 @@
+/*
+ * this file contains the pitch ratios used on note-on and the fast exp2/log2 for control changes
+ *
+ * a pitch in cents is split into octaves, semitones and cents, the ratios of the 12 semitones
+ * and the 100 cents are calculated at compile time into pitchTable, the octave is a power of two
+ * so Pitch_Ratio and Pitch_Rate are two lookups and a multiplication without any libm call
+ *
+ * Pitch_Exp2 and Pitch_Log2 replace pow() for the control rate parameters (loop length, adsr),
+ * the error is in the range of the float resolution (about 1e-7 relative)
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define PITCH_CENTS_MIN     (-120 * 100) /* 10 octaves */
+#define PITCH_CENTS_MAX     (120 * 100)
+
+/* 2^x for 0 <= x <= 1, taylor series in double, only used to build the table */
+constexpr double pitchExp2Series(double x)
+{
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 24; n++)
+    {
+        term *= x * 0.69314718055994530942 / n;
+        sum += term;
+    }
+    return sum;
+}
+
+struct pitch_table_s
+{
+    float semitone[12]; /* 2^(n/12) */
+    float cent[100]; /* 2^(n/1200) */
+    uint32_t semitoneQ31[12]; /* the same values with 31 fractional bits */
+    uint32_t centQ31[100];
+};
+
+constexpr pitch_table_s pitchMakeTable()
+{
+    pitch_table_s table = {};
+    for (int n = 0; n < 12; n++)
+    {
+        table.semitone[n] = pitchExp2Series(n / 12.0);
+        table.semitoneQ31[n] = (uint32_t)(pitchExp2Series(n / 12.0) * 2147483648.0 + 0.5);
+    }
+    for (int n = 0; n < 100; n++)
+    {
+        table.cent[n] = pitchExp2Series(n / 1200.0);
+        table.centQ31[n] = (uint32_t)(pitchExp2Series(n / 1200.0) * 2147483648.0 + 0.5);
+    }
+    return table;
+}
+
+constexpr pitch_table_s pitchTable = pitchMakeTable();
+
+/*
+ * splits cents into the octave and the cents within the octave (0..1199)
+ */
+static inline int Pitch_Octave(int *cents)
+{
+    int c = constrain(*cents, PITCH_CENTS_MIN, PITCH_CENTS_MAX);
+    int octave = (c - PITCH_CENTS_MIN) / 1200 + PITCH_CENTS_MIN / 1200; /* rounded down */
+    *cents = c - octave * 1200;
+    return octave;
+}
+
+/*
+ * frequency ratio of a pitch in cents
+ */
+inline float Pitch_Ratio(int cents)
+{
+    int octave = Pitch_Octave(&cents);
+    float ratio = pitchTable.semitone[cents / 100] * pitchTable.cent[cents % 100];
+    return (octave >= 0) ? ratio * (1u << octave) : ratio / (1u << -octave);
+}
+
+/*
+ * ratio of a pitch in cents with 32 fractional bits (phase increment of a voice), 0 cents is exactly 1 << 32
+ */
+inline uint64_t Pitch_Rate(int cents)
+{
+    int octave = Pitch_Octave(&cents);
+    const int shift = 62 - 32 - octave; /* the product has 62 fractional bits, octave is at most 10 */
+    return ((uint64_t)pitchTable.semitoneQ31[cents / 100] * pitchTable.centQ31[cents % 100] + (1ULL << (shift - 1))) >> shift;
+}
+
+union pitchFloatU
+{
+    float f;
+    uint32_t u;
+};
+
+/*
+ * 2^x, the integer part goes into the exponent, the rest (-0.5..0.5) is a polynomial
+ */
+inline float Pitch_Exp2(float x)
+{
+    x = constrain(x, -126.0f, 127.0f);
+    int i = (int)(x + 127.5f) - 127; /* rounded to nearest */
+    float f = (x - i) * 0.69314718f;
+    float p = 1.0f + f * (1.0f + f * (1.0f / 2 + f * (1.0f / 6 + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720))))));
+    union pitchFloatU scale;
+    scale.u = ((uint32_t)(i + 127)) << 23;
+    return p * scale.f;
+}
+
+/*
+ * log2(x) for x > 0, the exponent is taken from the float, the mantissa (0.707..1.414) uses the atanh series
+ */
+inline float Pitch_Log2(float x)
+{
+    union pitchFloatU v;
+    v.f = x;
+    int e = (int)((v.u >> 23) & 0xFF) - 127;
+    v.u = (v.u & 0x7FFFFF) | 0x3F800000;
+    if (v.f > 1.41421356f)
+    {
+        v.f *= 0.5f;
+        e++;
+    }
+    float t = (v.f - 1.0f) / (v.f + 1.0f);
+    float t2 = t * t;
+    return e + t * (2.88539008f + t2 * (0.96179669f + t2 * (0.57707802f + t2 * 0.41219858f)));
+}
+
+/*
+ * x^y for x >= 0
+ */
+inline float Pitch_Pow(float x, float y)
+{
+    return (x > 0.0f) ? Pitch_Exp2(y * Pitch_Log2(x)) : 0.0f;
+}
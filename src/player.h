@@ -1,22 +1,179 @@
+#pragma once
+
 #include <Arduino.h>
 #include "patch_manager.h"
+#include "pitch_table.h"
+#include "sample_arena.h"
 
-struct sample_player
+/*
+ * envelope of a slot, the values are per sample like the controls of the sampler:
+ * attack is added to the gain, decay and release are multipliers
+ * slots without envelope play one shots with a constant gain
+ */
+struct player_env_s
 {
     bool enabled;
-    // uint32_t start;
-    // uint32_t end;
-    int32_t pos;
+    float attack;
     float decay;
-    float decay_sample;
-    bool playing;
+    float sustain;
+    float release;
+};
+
+/*
+ * one sample slot, a slot can be played by multiple voices at the same time
+ * only the values used by the mix loop are kept here, the file of the slot is in playerSlotFiles
+ */
+struct sample_player
+{
+    int16_t *sampleStorage;
+    uint32_t numSamples;
+    uint32_t residentSamples; /* streamed samples keep only the first residentSamples in sampleStorage */
+    uint32_t loopStart; /* a held note loops loopStart..loopEnd-1, loopEnd 0: no loop */
+    uint32_t loopEnd;
+    uint64_t rate; /* 32.32 phase increment at the root note of the slot */
 
     float velocity; // 0.0 -> 1.0
-    uint8_t pan; // 0, 9, 18 (L, LR, R) 
-    char* filename[64];
+    float gain; /* level of the data, above 1.0 for quiet records (normalization), see playerSetGain */
+    uint8_t pan; // 0, 9, 18 (L, LR, R)
+    bool enabled;
 
-    uint32_t numSamples;
-    int16_t *sampleStorage;
+    struct player_env_s env;
+};
+
+/*
+ * the file of a slot, used when loading and by the stream service
+ */
+struct player_slot_file_s
+{
+    char filename[64];
+    File streamFile;
+    uint32_t streamDataStart; /* file offset of the first streamed sample */
+    uint16_t streamChannels;
+    uint8_t extent; /* arena extent of the data owned by the slot, SAMPLE_ARENA_NONE: the data belongs to the caller */
+};
+
+/*
+ * parameters of a single trigger (per step locks of the sequencer)
+ * only the values marked in flags replace the settings of the slot
+ */
+#define PLAYER_LOCK_VELOCITY    0x01
+#define PLAYER_LOCK_PAN         0x02
+#define PLAYER_LOCK_START       0x04
+#define PLAYER_LOCK_PITCH       0x08
+#define PLAYER_LOCK_RETRIGGER   0x10 /* ratchet: continues on the latest voice of the slot, the previous playback fades out */
+
+struct player_lock_s
+{
+    uint8_t flags;
+    uint8_t velocity; /* 0..255, scales the volume of the slot */
+    uint8_t pan; /* 0, 9, 18 (L, LR, R) */
+    uint8_t start; /* start position in 1/256 of the sample length */
+    int8_t pitch; /* semitones */
+    int8_t fine; /* cents, added to pitch */
+};
+
+#define PLAYER_PAN_SLOT     0xFF /* the voice follows the pan of its slot */
+
+/*
+ * pitched voices advance a 32.32 phase (pos.frac) by rate per frame, 1 << 32 is the native rate
+ * the native rate is mixed without interpolation
+ */
+#define PLAYER_RATE_NATIVE  (1ULL << 32)
+#define PLAYER_PITCH_MIN    (-48 * 100) /* cents */
+#define PLAYER_PITCH_MAX    (24 * 100) /* cents, a rate of 4 */
+#define PLAYER_RATE_MAX     4
+#define PLAYER_RATE_MIN     (1.0f / 16) /* the rate of PLAYER_PITCH_MIN */
+#define PLAYER_RESAMPLE_CHUNK   64 /* frames resampled in one piece */
+
+/* the envelope is evaluated once per PLAYER_ENV_BLOCK frames, the gain is ramped within */
+#define PLAYER_ENV_BLOCK    16
+
+enum playerEnvState
+{
+    player_env_off, /* one shot, constant gain */
+    player_env_attack,
+    player_env_decay,
+    player_env_sustain,
+    player_env_release,
+};
+
+#define PLAYER_NOTE_NONE    0xFF /* voice started by a trigger, not by a note */
+
+/*
+ * a voice plays the sampleStorage of a slot, voices are taken from a fixed pool
+ * only the values used by the mix loop are kept here, the state which is scanned over all voices
+ * (playing, trigger order, note) is in playerVoiceMask and playerVoiceMeta
+ *
+ * the mix loop reads all values of one voice once per block and then only the sample data,
+ * so they stay one record per voice: arrays per value (phase, rate, gains) were not faster in the host bench,
+ * the 8 records (448 bytes) stay in L1 on the host and are in uncached internal DRAM on the ESP32
+ */
+struct player_voice_s
+{
+    struct sample_player *player; /* slot played by this voice */
+    uint32_t pos; /* integer part of the phase, the next sample at the native rate */
+    uint32_t frac; /* fractional part of the phase */
+
+    /* set up by the trigger from the locks, the mix loops only read them once per block */
+    uint64_t rate; /* 32.32 phase increment per frame */
+    float velocity; /* multiplier of the slot velocity */
+    float envGain; /* 1.0 for one shots */
+    uint8_t envState; /* enum playerEnvState */
+    uint8_t pan; /* PLAYER_PAN_SLOT or locked pan */
+    bool pressed; /* the note is held, the loop of the slot is played */
+    bool wrapped; /* the loop was played once, the sample before the loop start is the one before the loop end */
+
+    /*
+     * ring buffer for streamed samples, filled by playerStreamService
+     * contains the samples up to playerVoiceStreamEnd (exclusive)
+     */
+    int16_t *streamBuff;
+    uint32_t streamTag; /* generation of the playback and the loaded halves of the ring, see playerStreamTag */
+};
+
+/*
+ * values of a voice which are only used to find a voice, indexed like playerVoices
+ */
+struct player_voice_meta_s
+{
+    uint32_t serial; /* trigger order, used to find the oldest voice */
+    uint8_t ch; /* note which started the voice, PLAYER_NOTE_NONE for triggers */
+    uint8_t note;
+};
+
+/* one bit per voice in playerVoiceMask */
+static_assert(PLAYER_MAX_VOICES <= 32, "playerVoiceMask has 32 bits");
+
+/*
+ * a tail is a playback which fades out next to the new playback of its voice (retrigger, steal),
+ * at the end of a sample the last value fades out (player is NULL)
+ * the tails have their own pool, so rapid retriggers do not cut the tails which are still running
+ */
+struct player_tail_s
+{
+    struct sample_player *player;
+    const int16_t *streamBuff; /* stream buffer of the voice, valid unless the new playback starts behind the resident head */
+    uint32_t pos;
+    uint32_t frac;
+    uint64_t rate;
+    uint32_t streamEnd;
+    int16_t hold; /* last value of an ended sample */
+    uint16_t left; /* frames of the fade left, 0: unused */
+    float gain_l; /* gain including velocity and pan */
+    float gain_r;
+};
+
+/*
+ * what happens when a slot is triggered
+ * - oldest: new voice, when all are busy the oldest voice is stolen
+ * - quietest: new voice, when all are busy the quietest voice is stolen
+ * - choke: a slot plays only one voice, a retrigger restarts it
+ */
+enum playerStealMode
+{
+    player_steal_oldest,
+    player_steal_quietest,
+    player_steal_choke,
 };
 
 // precompute because easier, L, R
@@ -26,58 +183,296 @@ const float pan_lut[2][19] =
     {0.000, 0.087, 0.174, 0.259, 0.342, 0.423, 0.500, 0.574, 0.643, 0.707, 0.766, 0.819, 0.866, 0.906, 0.940, 0.966, 0.985, 0.996, 1.000}
 };
 
+#ifdef PLAYER_FIXED_POINT
+/* int16 sample * Q15 gain is shifted down to PLAYER_MIX_FRAC_BITS */
+#define PLAYER_MIX_SHIFT    (15 + 15 - PLAYER_MIX_FRAC_BITS)
+#endif
+
+/* gain of the tail with n frames left, filled by playerInit */
+float playerFadeLut[PLAYER_FADE_LEN];
+#ifdef PLAYER_FIXED_POINT
+int32_t playerFadeLutQ15[PLAYER_FADE_LEN];
+#endif
+
 uint32_t totalSampleStorageLen;
 uint8_t sampleCount;
 
 struct sample_player samplePlayers[NUM_PLAYERS];
+struct player_slot_file_s playerSlotFiles[NUM_PLAYERS];
+struct player_voice_s playerVoices[PLAYER_MAX_VOICES];
+struct player_voice_meta_s playerVoiceMeta[PLAYER_MAX_VOICES];
+uint32_t playerVoiceMask = 0; /* bit i is set while playerVoices[i] is playing, only changed by the audio task */
+struct player_tail_s playerTails[PLAYER_MAX_TAILS];
+
+enum playerStealMode playerStealMode = PLAYER_STEAL_MODE;
+uint32_t playerVoiceSerial = 0;
+
+uint32_t playerStreamThreshold = PLAYER_STREAM_THRESHOLD;
+uint32_t playerStreamUnderruns = 0; /* blocks where a voice did not get its streamed data in time */
+uint32_t playerStreamUnderrunSamples = 0;
+bool playerStreamActive = false; /* SD card stays mounted while samples are streamed */
+
+/* incremented by the audio task after each playerProcess, tells the arena when released sample data is not read anymore */
+uint32_t playerProcessSeq = 0;
+bool playerSlotsLocked = false; /* set by playerLockSlots, the slots cannot be loaded anymore */
+
+#define PLAYER_VOICE_ALL    ((uint32_t)((1ULL << PLAYER_MAX_VOICES) - 1))
+
+static inline uint32_t playerVoiceBit(const struct player_voice_s *voice)
+{
+    return 1u << (voice - playerVoices);
+}
+
+static inline bool playerVoicePlaying(const struct player_voice_s *voice)
+{
+    return (playerVoiceMask & playerVoiceBit(voice)) != 0;
+}
+
+static inline struct player_voice_meta_s *playerVoiceGetMeta(const struct player_voice_s *voice)
+{
+    return &playerVoiceMeta[voice - playerVoices];
+}
+
+/*
+ * the stream service and the audio task share streamTag: the low PLAYER_STREAM_HALVES_BITS count the loaded
+ * halves of the ring behind the resident samples, the bits above are the serial of the playback.
+ * the service publishes a half with a compare and swap, a retrigger changes the serial so the swap fails
+ */
+#define PLAYER_STREAM_HALVES_BITS   20
+#define PLAYER_STREAM_HALVES_MASK   ((1u << PLAYER_STREAM_HALVES_BITS) - 1)
+
+static inline uint32_t playerStreamTag(uint32_t serial, uint32_t halves)
+{
+    return (serial << PLAYER_STREAM_HALVES_BITS) | halves;
+}
+
+static inline uint32_t playerStreamEnd(const struct sample_player *player, uint32_t tag)
+{
+    const uint32_t end = player->residentSamples + (tag & PLAYER_STREAM_HALVES_MASK) * (PLAYER_STREAM_BUFF_LEN / 2);
+    return min(end, player->numSamples);
+}
+
+static inline uint32_t playerVoiceStreamEnd(const struct player_voice_s *voice)
+{
+    return playerStreamEnd(voice->player, __atomic_load_n(&voice->streamTag, __ATOMIC_ACQUIRE));
+}
+
+static inline void playerVoiceStop(struct player_voice_s *voice)
+{
+    playerVoiceMask &= ~playerVoiceBit(voice);
+    voice->pos = 0;
+    voice->frac = 0;
+}
+
+/*
+ * the slots are the users of the sample data, a moved extent changes the slots which point into it
+ */
+static void playerArenaRemap(const int16_t *from, int16_t *to, uint32_t len)
+{
+    for (int i = 0; i < NUM_PLAYERS; i++)
+    {
+        int16_t *data = samplePlayers[i].sampleStorage;
+        if ((data >= from) && (data < from + len))
+        {
+            __atomic_store_n(&samplePlayers[i].sampleStorage, to + (data - from), __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static bool playerArenaInUse(const int16_t *data, uint32_t len)
+{
+    for (int i = 0; i < NUM_PLAYERS; i++)
+    {
+        if ((samplePlayers[i].sampleStorage >= data) && (samplePlayers[i].sampleStorage < data + len))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * creates the arena when the first sample is allocated, it takes the free PSRAM except SAMPLE_ARENA_RESERVE
+ * so the other users of PSRAM (delay, stream buffers) have to allocate before
+ */
+bool playerArenaInit(void)
+{
+    if (sampleArena.base == NULL)
+    {
+        const uint32_t freePSRAM = ESP.getFreePsram();
+        const uint32_t size = (freePSRAM > SAMPLE_ARENA_RESERVE) ? (freePSRAM - SAMPLE_ARENA_RESERVE) : 0;
+        void *base = (size > 0) ? ps_malloc(size) : NULL;
+        if (base == NULL)
+        {
+            Serial.printf("not enough PSRAM memory for the sample arena!\n");
+            return false;
+        }
+        SampleArena_Init(base, size);
+        sampleArena_remapCb = playerArenaRemap;
+        sampleArena_inUseCb = playerArenaInUse;
+        Serial.printf("Sample arena: %u samples, %0.2fs\n", sampleArena.len, ((float)sampleArena.len) / SAMPLE_RATE);
+    }
+    return true;
+}
+
+/*
+ * releases sample data, the memory is reused when the audio task does not read it anymore
+ */
+void playerArenaRetire(uint8_t extent)
+{
+    if (extent != SAMPLE_ARENA_NONE)
+    {
+        SampleArena_Retire(extent);
+    }
+}
+
+/*
+ * frees the released sample data and compacts the arena in slices, call this regularly from core 0
+ * the arena is only changed by this task (loading and deleting samples included)
+ */
+void playerArenaService(void)
+{
+    SampleArena_Service(&playerProcessSeq, SAMPLE_ARENA_SLICE);
+}
+
+/*
+ * allocates the data of a slot in the arena, the previous data of the slot is released
+ * the data is not moved until the slot uses it (playerSetSample, playerLoadWav)
+ */
+int16_t *playerSampleAlloc(uint8_t sampleNum, uint32_t numSamples)
+{
+    if (!playerArenaInit())
+    {
+        return NULL;
+    }
+    const uint8_t extent = SampleArena_Alloc(numSamples);
+    if (extent == SAMPLE_ARENA_NONE)
+    {
+        return NULL;
+    }
+    SampleArena_Pin(extent, true);
+    playerArenaRetire(playerSlotFiles[sampleNum].extent);
+    playerSlotFiles[sampleNum].extent = extent;
+    return SampleArena_Data(extent);
+}
+
+/*
+ * the loaders below write the slot directly, they are only used before the audio task runs:
+ * a voice started in between could see the new length with the old data
+ * the firmware calls this before the audio task is started, loading a slot is refused afterwards
+ * (the sampler publishes its slots through the audio task instead, see sample_player.h)
+ */
+void playerLockSlots(void)
+{
+    playerSlotsLocked = true;
+}
+
+static bool playerSlotLoadable(uint8_t sampleNum)
+{
+    if (sampleNum >= NUM_PLAYERS)
+    {
+        Serial.println("Invalid sample number");
+        return false;
+    }
+    if (playerSlotsLocked)
+    {
+        Serial.println("The slots are only loaded before the audio task is started");
+        return false;
+    }
+    return true;
+}
 
 bool playerLoadWav(uint8_t sampleNum, char* filename)
 {
+    if (!playerSlotLoadable(sampleNum))
+    {
+        return false;
+    }
     struct sample_player *newPatch = &samplePlayers[sampleNum];
-    // newPatch = {}; // reset
-    auto freePSRAM =  ESP.getFreePsram();
+    struct player_slot_file_s *slotFile = &playerSlotFiles[sampleNum];
+    playerArenaInit();
+    auto freePSRAM = SampleArena_FreeMax() * sizeof(int16_t);
 
     if (PatchManager_PrepareSdCard())
     {
-        auto dataSize = PatchManager_WaveSize(SD_MMC, filename);
+        if (slotFile->streamFile)
+        {
+            slotFile->streamFile.close();
+        }
+
+        uint16_t channels;
+        File f;
+        uint32_t numSamples = PatchManager_OpenWavStream(SD_MMC, filename, f, &channels);
+        uint32_t dataSize = numSamples * sizeof(int16_t);
         Serial.print("Datasize: ");
         Serial.println(dataSize);
-        if(dataSize > freePSRAM)
+        if (numSamples == 0)
         {
-            Serial.println("not enough PSRAM memory for sample storage!");
+            Serial.println("Error reading wav");
+            if (!playerStreamActive)
+            {
+                SD_MMC.end();
+            }
             return false;
         }
 
-        newPatch->numSamples = dataSize / 2;
-        newPatch->sampleStorage = (int16_t *)ps_malloc(dataSize);
-        if (newPatch->sampleStorage == NULL)
+        /* keep only the head in PSRAM when the sample is too big, the rest will be streamed */
+        uint32_t residentSamples = numSamples;
+        if ((dataSize > playerStreamThreshold) || (dataSize > freePSRAM))
+        {
+            const uint32_t half = PLAYER_STREAM_BUFF_LEN / 2;
+            residentSamples = ((((uint64_t)SAMPLE_RATE) * PLAYER_STREAM_HEAD_MS / 1000 + half - 1) / half) * half;
+            residentSamples = min(residentSamples, numSamples);
+        }
+
+        int16_t *data = playerSampleAlloc(sampleNum, residentSamples);
+        if (data == NULL)
         {
             Serial.printf("Could not allocate psram!\n");
+            f.close();
             return false;
         }
 
-        auto readWavSamples = PatchManager_LoadWavefile(SD_MMC, filename, newPatch->sampleStorage, dataSize);
-        SD_MMC.end();
-        Serial.printf("Read %d samples from %s on SD_MMC\n", readWavSamples, filename);
+        auto readWavSamples = PatchManager_ReadWavSamples(f, channels, data, residentSamples);
+        SampleArena_Pin(slotFile->extent, false);
 
-        if(readWavSamples > 0)
+        if (residentSamples < numSamples)
+        {
+            slotFile->streamDataStart = 44 + residentSamples * sizeof(int16_t) * channels;
+            slotFile->streamChannels = channels;
+            slotFile->streamFile = f;
+            playerStreamActive = true;
+            Serial.printf("Streaming %d samples from %s, %d samples in PSRAM\n", numSamples, filename, residentSamples);
+        }
+        else
         {
-            struct sample_player *newPatch = &samplePlayers[sampleCount];
-            sampleCount++;
+            f.close();
+            if (!playerStreamActive)
+            {
+                SD_MMC.end();
+            }
+        }
+        Serial.printf("Read %d samples from %s on SD_MMC\n", readWavSamples, filename);
 
-            newPatch->velocity = 1.0f;
-            newPatch->pan = 0.0f;
-            memcpy(newPatch->filename, currentFileNameWav, sizeof(currentFileNameWav));
-            newPatch->enabled = true;
-            newPatch->playing = false;
-            newPatch->pos = 0;
-            newPatch->decay_sample = 0.0f;
-            newPatch->decay = 0.0f;
-            newPatch->pan = 9;
+        /* the slot is the one which was loaded, not the next one after sampleCount */
+        newPatch->sampleStorage = data;
+        newPatch->numSamples = numSamples;
+        newPatch->residentSamples = residentSamples;
+        newPatch->loopStart = 0;
+        newPatch->loopEnd = 0;
+        newPatch->rate = PLAYER_RATE_NATIVE;
+        newPatch->env.enabled = false;
+        newPatch->velocity = 1.0f;
+        newPatch->gain = 1.0f;
+        newPatch->pan = 9;
+        newPatch->enabled = (readWavSamples > 0);
+        memcpy(slotFile->filename, currentFileNameWav, sizeof(currentFileNameWav));
 
-            if (newPatch->sampleStorage == NULL)
+        if (readWavSamples > 0)
+        {
+            if (sampleNum >= sampleCount)
             {
-                Serial.printf("not enough PSRAM memory for sampleStorage!\n");
+                sampleCount = sampleNum + 1;
             }
             Serial.println("Successfully init sample");
         }
@@ -89,6 +484,52 @@ bool playerLoadWav(uint8_t sampleNum, char* filename)
     return true;
 }
 
+/*
+ * assign already loaded sample data to a player (used when the data does not come from a wav file)
+ */
+bool playerSetSample(uint8_t sampleNum, int16_t *sampleStorage, uint32_t numSamples)
+{
+    if (!playerSlotLoadable(sampleNum))
+    {
+        return false;
+    }
+    struct sample_player *newPatch = &samplePlayers[sampleNum];
+    struct player_slot_file_s *slotFile = &playerSlotFiles[sampleNum];
+
+    /* data outside of the extent of the slot belongs to the caller, the extent is released */
+    if (slotFile->extent != SAMPLE_ARENA_NONE)
+    {
+        const int16_t *owned = SampleArena_Data(slotFile->extent);
+        if ((sampleStorage >= owned) && (sampleStorage < owned + SampleArena_Len(slotFile->extent)))
+        {
+            SampleArena_Pin(slotFile->extent, false);
+        }
+        else
+        {
+            playerArenaRetire(slotFile->extent);
+            slotFile->extent = SAMPLE_ARENA_NONE;
+        }
+    }
+
+    newPatch->sampleStorage = sampleStorage;
+    newPatch->numSamples = numSamples;
+    newPatch->residentSamples = numSamples;
+    newPatch->loopStart = 0;
+    newPatch->loopEnd = 0;
+    newPatch->rate = PLAYER_RATE_NATIVE;
+    newPatch->env.enabled = false;
+    newPatch->velocity = 1.0f;
+    newPatch->gain = 1.0f;
+    newPatch->enabled = true;
+    newPatch->pan = 9;
+
+    if (sampleNum >= sampleCount)
+    {
+        sampleCount = sampleNum + 1;
+    }
+    return true;
+}
+
 bool playerSetPan(uint8_t sampleNum, uint8_t pan)
 {
     if (pan >= 19)
@@ -111,68 +552,1161 @@ bool playerSetVol(uint8_t sampleNum, uint8_t vol)
     return true;
 }
 
-bool playerSampleOn(uint8_t sampleNum)
+/*
+ * level of the sample data, applied at playback together with the velocity
+ * the peak of the data times gain must stay within int16 (the fixed point mix has no headroom for more)
+ */
+void playerSetGain(uint8_t sampleNum, float gain)
+{
+    samplePlayers[sampleNum].gain = gain;
+}
+
+/*
+ * a held note loops start..end-1 of the slot, the loop must be within the resident samples
+ */
+bool playerSetLoop(uint8_t sampleNum, uint32_t start, uint32_t end)
 {
     struct sample_player *player = &samplePlayers[sampleNum];
-    if(player->enabled)
+    if ((start >= end) || (end > player->residentSamples))
+    {
+        player->loopStart = 0;
+        player->loopEnd = 0;
+        return false;
+    }
+    player->loopStart = start;
+    player->loopEnd = end;
+    return true;
+}
+
+/*
+ * the envelope is used by the following notes and triggers, see struct player_env_s
+ */
+void playerSetEnvelope(uint8_t sampleNum, const struct player_env_s *env)
+{
+    samplePlayers[sampleNum].env = *env;
+}
+
+/*
+ * phase increment of a playback speed (1.0 is the recorded speed)
+ * slower speeds (and 0 or below) are clamped to PLAYER_RATE_MIN: a voice at rate 0 would never reach its end
+ */
+static inline uint64_t playerRatioRate(float ratio)
+{
+    return (uint64_t)(((ratio > PLAYER_RATE_MIN) ? min(ratio, (float)PLAYER_RATE_MAX) : PLAYER_RATE_MIN) * 4294967296.0f);
+}
+
+/*
+ * playback speed of the root note of the slot
+ */
+void playerSetRatio(uint8_t sampleNum, float ratio)
+{
+    samplePlayers[sampleNum].rate = playerRatioRate(ratio);
+}
+
+void playerSetStealMode(enum playerStealMode mode)
+{
+    playerStealMode = mode;
+}
+
+/*
+ * returns the voice which should play the next trigger of a slot
+ */
+struct player_voice_s *playerGetVoice(struct sample_player *player)
+{
+    if (playerStealMode == player_steal_choke)
     {
-        if(player->playing)
+        for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
         {
-            player->decay_sample = ((float)player->sampleStorage[player->pos]) / ((float)0x8000) * player->velocity;
-            player->pos = 0;
-            return true;
+            const int i = __builtin_ctz(mask);
+            if (playerVoices[i].player == player)
+            {
+                return &playerVoices[i];
+            }
         }
-        player->playing = true;
-        return true;
     }
-    return false;
+
+    const uint32_t idle = ~playerVoiceMask & PLAYER_VOICE_ALL;
+    if (idle != 0)
+    {
+        return &playerVoices[__builtin_ctz(idle)];
+    }
+
+    struct player_voice_s *stolen = &playerVoices[0];
+    if (playerStealMode == player_steal_quietest)
+    {
+        /* one shots are getting quieter, the level is estimated from velocity and remaining length */
+        float lowestLevel = 2.0f;
+        for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+        {
+            struct player_voice_s *voice = &playerVoices[i];
+            float level = voice->player->velocity * voice->player->gain * voice->velocity * voice->envGain * (voice->player->numSamples - voice->pos) / voice->player->numSamples;
+            if (level < lowestLevel)
+            {
+                stolen = voice;
+                lowestLevel = level;
+            }
+        }
+    }
+    else
+    {
+        /* only the serials are compared, the voices are not touched */
+        int oldest = 0;
+        for (int i = 1; i < PLAYER_MAX_VOICES; i++)
+        {
+            if ((int32_t)(playerVoiceMeta[i].serial - playerVoiceMeta[oldest].serial) < 0)
+            {
+                oldest = i;
+            }
+        }
+        stolen = &playerVoices[oldest];
+    }
+    return stolen;
 }
 
-void playerProcess(float *signal_l, float *signal_r, const int buffLen)
+/*
+ * a retrigger (ratchet) continues on the latest voice of the slot, the previous playback becomes
+ * the tail of the voice, so a roll uses one voice and never steals the voices of other slots
+ * returns NULL when the slot does not play
+ */
+static struct player_voice_s *playerGetRetriggerVoice(struct sample_player *player)
+{
+    int latest = -1;
+    for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
+    {
+        const int i = __builtin_ctz(mask);
+        if ((playerVoices[i].player == player) && ((latest < 0) || ((int32_t)(playerVoiceMeta[i].serial - playerVoiceMeta[latest].serial) > 0)))
+        {
+            latest = i;
+        }
+    }
+    return (latest < 0) ? NULL : &playerVoices[latest];
+}
+
+static inline uint8_t playerVoicePan(const struct player_voice_s *voice)
+{
+    return (voice->pan == PLAYER_PAN_SLOT) ? voice->player->pan : voice->pan;
+}
+
+/*
+ * moves the current playback of a voice into a tail, last is the last value when the sample has ended
+ * when all tails are busy the one which is closest to its end is replaced
+ * a sample which ended at 0 needs no fade, NULL is returned and no tail is taken
+ */
+static struct player_tail_s *playerTailStart(const struct player_voice_s *voice, bool ended, int16_t last)
 {
-    for (int i = 0; i < sampleCount; i++)
+    if (ended && (last == 0))
+    {
+        return NULL;
+    }
+
+    struct player_tail_s *tail = &playerTails[0];
+    for (int i = 1; (i < PLAYER_MAX_TAILS) && (tail->left > 0); i++)
     {
-        struct sample_player *player = &samplePlayers[i];
+        if (playerTails[i].left < tail->left)
+        {
+            tail = &playerTails[i];
+        }
+    }
+
+    const float gain = voice->player->velocity * voice->player->gain * voice->velocity * voice->envGain / ((float)0x8000);
+    const uint8_t pan = playerVoicePan(voice);
+    tail->player = ended ? NULL : voice->player;
+    tail->streamBuff = voice->streamBuff;
+    tail->pos = voice->pos;
+    tail->frac = voice->frac;
+    tail->rate = voice->rate;
+    tail->streamEnd = playerVoiceStreamEnd(voice);
+    tail->hold = last;
+    tail->left = PLAYER_FADE_LEN;
+    tail->gain_l = gain * pan_lut[0][pan];
+    tail->gain_r = gain * pan_lut[1][pan];
+    return tail;
+}
+
+/*
+ * phase increment of a pitch in cents, table based so the trigger does not call libm
+ */
+static inline uint64_t playerPitchRate(int cents)
+{
+    return Pitch_Rate(constrain(cents, PLAYER_PITCH_MIN, PLAYER_PITCH_MAX));
+}
 
-        for (int n = 0; n < buffLen; n++)
+/*
+ * a * b of two 32.32 rates without a 128 bit product, the integer parts are small
+ */
+static inline uint64_t playerRateMul(uint64_t a, uint64_t b)
+{
+    const uint64_t ah = a >> 32, al = (uint32_t)a;
+    const uint64_t bh = b >> 32, bl = (uint32_t)b;
+    return ((ah * bh) << 32) + ah * bl + al * bh + ((al * bl) >> 32);
+}
+
+/*
+ * starts a voice of the slot, the lock (can be NULL) is resolved here once per trigger
+ * returns NULL when the slot is not loaded
+ */
+static struct player_voice_s *playerVoiceStart(uint8_t sampleNum, const struct player_lock_s *lock)
+{
+    struct sample_player *player = &samplePlayers[sampleNum];
+    if(player->enabled)
+    {
+        struct player_voice_s *voice = NULL;
+        if ((lock != NULL) && (lock->flags & PLAYER_LOCK_RETRIGGER))
+        {
+            voice = playerGetRetriggerVoice(player);
+        }
+        if (voice == NULL)
+        {
+            voice = playerGetVoice(player);
+        }
+        if(playerVoicePlaying(voice))
+        {
+            /* the old playback fades out next to the new one */
+            playerTailStart(voice, false, 0);
+        }
+        voice->player = player;
+        voice->pos = 0;
+        voice->frac = 0;
+        voice->rate = player->rate;
+        voice->velocity = 1.0f;
+        voice->pan = PLAYER_PAN_SLOT;
+        voice->pressed = false;
+        voice->wrapped = false;
+        if (lock != NULL)
         {
-            float sample_f = 0;
-            if (player->decay_sample != 0.0)
+            if (lock->flags & PLAYER_LOCK_VELOCITY)
             {
-                if (player->decay_sample > AUDIBLE_LIMIT)
-                {
-                    player->decay_sample *= 0.99;
-                    sample_f += player->decay_sample;
-                }
-                else
-                {
-                    player->decay_sample = 0;
-                }
+                voice->velocity = lock->velocity / 255.0f;
             }
-            if (player->playing)
+            if ((lock->flags & PLAYER_LOCK_PAN) && (lock->pan < 19))
             {
-                sample_f += ((float)player->sampleStorage[player->pos]) / ((float)0x8000);
-                sample_f *= player->velocity;
-                player->pos += 1;
-                if (player->pos >= player->numSamples)
-                {
-                    player->playing = false;
-                    player->decay_sample = sample_f;
-                    player->pos = 0;
-                }
-                // panning
-                signal_l[n] += sample_f * pan_lut[0][player->pan];
-                signal_r[n] += sample_f * pan_lut[1][player->pan];
+                voice->pan = lock->pan;
+            }
+            if (lock->flags & PLAYER_LOCK_START)
+            {
+                /* a start behind the resident head of a streamed sample underruns until the stream has caught up */
+                voice->pos = (uint32_t)(((uint64_t)player->numSamples * lock->start) >> 8);
+            }
+            if (lock->flags & PLAYER_LOCK_PITCH)
+            {
+                voice->rate = playerRateMul(player->rate, playerPitchRate(lock->pitch * 100 + lock->fine));
+                voice->rate = min(voice->rate, ((uint64_t)PLAYER_RATE_MAX) << 32);
             }
         }
+        /* attack from the audible limit like the sampler did, one shots start at full gain */
+        voice->envState = player->env.enabled ? player_env_attack : player_env_off;
+        voice->envGain = player->env.enabled ? AUDIBLE_LIMIT : 1.0f;
+        struct player_voice_meta_s *meta = playerVoiceGetMeta(voice);
+        meta->serial = ++playerVoiceSerial;
+        __atomic_store_n(&voice->streamTag, playerStreamTag(meta->serial, 0), __ATOMIC_RELEASE);
+        meta->ch = PLAYER_NOTE_NONE;
+        meta->note = PLAYER_NOTE_NONE;
+        playerVoiceMask |= playerVoiceBit(voice);
+        return voice;
     }
+    return NULL;
 }
 
-void playerInit()
+bool playerSampleOn(uint8_t sampleNum, const struct player_lock_s *lock = NULL)
 {
-    psramInit();
-    Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
-    Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
+    return playerVoiceStart(sampleNum, lock) != NULL;
+}
+
+/*
+ * starts a held note, the voice plays the loop of the slot until playerNoteOff
+ * cents is the pitch relative to the root note of the slot
+ */
+struct player_voice_s *playerNoteOn(uint8_t sampleNum, uint8_t ch, uint8_t note, float velocity, int cents)
+{
+    struct player_lock_s lock = {};
+    if (cents != 0)
+    {
+        cents = constrain(cents, PLAYER_PITCH_MIN, PLAYER_PITCH_MAX);
+        lock.flags = PLAYER_LOCK_PITCH;
+        lock.pitch = cents / 100;
+        lock.fine = cents % 100;
+    }
+    struct player_voice_s *voice = playerVoiceStart(sampleNum, &lock);
+    if (voice != NULL)
+    {
+        voice->velocity = velocity;
+        voice->pressed = true;
+        playerVoiceGetMeta(voice)->ch = ch;
+        playerVoiceGetMeta(voice)->note = note;
+    }
+    return voice;
+}
+
+/*
+ * releases the voices of a note, the envelope goes into release, a one shot plays to its end
+ */
+void playerNoteOff(uint8_t ch, uint8_t note)
+{
+    for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
+    {
+        const int i = __builtin_ctz(mask);
+        struct player_voice_s *voice = &playerVoices[i];
+        if ((playerVoiceMeta[i].ch == ch) && (playerVoiceMeta[i].note == note) && voice->pressed)
+        {
+            voice->pressed = false;
+            if (voice->envState != player_env_off)
+            {
+                voice->envState = player_env_release;
+            }
+        }
+    }
+}
+
+/*
+ * changes the velocity of the voices of a note
+ */
+void playerNoteVelocity(uint8_t ch, uint8_t note, float velocity)
+{
+    for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
+    {
+        const int i = __builtin_ctz(mask);
+        if ((playerVoiceMeta[i].ch == ch) && (playerVoiceMeta[i].note == note))
+        {
+            playerVoices[i].velocity = velocity;
+        }
+    }
+}
+
+/*
+ * changes the playback speed of the voices of a note, 1.0 is the recorded speed
+ * a voice does not play backwards, at 0 and below it is stopped and its playback fades out
+ */
+void playerNoteSpeed(uint8_t ch, uint8_t note, float ratio)
+{
+    for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
+    {
+        const int i = __builtin_ctz(mask);
+        struct player_voice_s *voice = &playerVoices[i];
+        if ((playerVoiceMeta[i].ch == ch) && (playerVoiceMeta[i].note == note))
+        {
+            if (ratio > 0.0f)
+            {
+                voice->rate = playerRatioRate(ratio);
+            }
+            else
+            {
+                voice->pressed = false;
+                playerTailStart(voice, false, 0);
+                playerVoiceStop(voice);
+            }
+        }
+    }
+}
+
+/*
+ * stops the voices of a slot, their playbacks fade out in tails
+ */
+void playerStopSlot(uint8_t sampleNum)
+{
+    const struct sample_player *player = &samplePlayers[sampleNum];
+    for (uint32_t mask = playerVoiceMask; mask != 0; mask &= mask - 1)
+    {
+        const int i = __builtin_ctz(mask);
+        struct player_voice_s *voice = &playerVoices[i];
+        if (voice->player == player)
+        {
+            voice->pressed = false;
+            playerTailStart(voice, false, 0);
+            playerVoiceStop(voice);
+        }
+    }
+}
+
+void playerStopAll(void)
+{
+    for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+    {
+        playerVoiceStop(&playerVoices[i]);
+    }
+    for (int i = 0; i < PLAYER_MAX_TAILS; i++)
+    {
+        playerTails[i].left = 0;
+    }
+}
+
+/*
+ * returns the sample data of a playback at pos
+ * len is reduced to the samples which can be read in one piece
+ * NULL is returned when the streamed data did not arrive in time
+ */
+static inline const int16_t *playerData(const struct sample_player *player, const int16_t *streamBuff, uint32_t streamEnd, uint32_t pos, int *len)
+{
+    uint32_t avail;
+
+    if (pos < player->residentSamples)
+    {
+        avail = player->residentSamples - pos;
+        if (avail < (uint32_t)*len)
+        {
+            *len = avail;
+        }
+        return &player->sampleStorage[pos];
+    }
+
+    if ((streamBuff == NULL) || (pos >= streamEnd))
+    {
+        return NULL;
+    }
+    uint32_t idx = pos & (PLAYER_STREAM_BUFF_LEN - 1);
+    avail = min(streamEnd - pos, (uint32_t)PLAYER_STREAM_BUFF_LEN - idx);
+    if (avail < (uint32_t)*len)
+    {
+        *len = avail;
+    }
+    return &streamBuff[idx];
+}
+
+static inline const int16_t *playerVoiceData(struct player_voice_s *voice, int *len)
+{
+    return playerData(voice->player, voice->streamBuff, playerVoiceStreamEnd(voice), voice->pos, len);
+}
+
+/*
+ * refills the stream buffers of the voices, call this regularly from a task which is allowed to block
+ * one half of a ring buffer is read while the audio task plays the other half
+ */
+void playerStreamService(void)
+{
+    const uint32_t half = PLAYER_STREAM_BUFF_LEN / 2;
+
+    for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+    {
+        struct player_voice_s *voice = &playerVoices[i];
+        struct sample_player *player = voice->player;
+
+        if ((!playerVoicePlaying(voice)) || (player == NULL) || (player->residentSamples >= player->numSamples) || (voice->streamBuff == NULL))
+        {
+            continue;
+        }
+        struct player_slot_file_s *slotFile = &playerSlotFiles[player - samplePlayers];
+
+        /* the voice can be retriggered while the file is read, the tag is only updated when it did not change */
+        uint32_t tag = __atomic_load_n(&voice->streamTag, __ATOMIC_ACQUIRE);
+        uint32_t pos = voice->pos;
+        uint32_t halves = tag & PLAYER_STREAM_HALVES_MASK;
+        uint32_t streamEnd = playerStreamEnd(player, tag);
+
+        if ((streamEnd < pos) && (pos >= player->residentSamples))
+        {
+            /* after an underrun continue with the half which is played now */
+            halves = (pos - player->residentSamples) / half;
+            streamEnd = player->residentSamples + halves * half;
+        }
+
+        while ((streamEnd < player->numSamples) && (streamEnd - pos <= half) && (halves < PLAYER_STREAM_HALVES_MASK))
+        {
+            uint32_t count = min(half, player->numSamples - streamEnd);
+            slotFile->streamFile.seek(slotFile->streamDataStart + (streamEnd - player->residentSamples) * sizeof(int16_t) * slotFile->streamChannels);
+            uint32_t samplesRead = PatchManager_ReadWavSamples(slotFile->streamFile, slotFile->streamChannels, &voice->streamBuff[streamEnd & (PLAYER_STREAM_BUFF_LEN - 1)], count);
+            if (samplesRead < count)
+            {
+                memset(&voice->streamBuff[(streamEnd + samplesRead) & (PLAYER_STREAM_BUFF_LEN - 1)], 0, (count - samplesRead) * sizeof(int16_t));
+            }
+
+            const uint32_t next = (tag & ~PLAYER_STREAM_HALVES_MASK) | (halves + 1);
+            if (!__atomic_compare_exchange_n(&voice->streamTag, &tag, next, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            tag = next;
+            halves++;
+            streamEnd += count;
+        }
+    }
+}
+
+/*
+ * interpolation kernels, x[0..3] are the samples at pos - 1 .. pos + 2, frac is the position between x[1] and x[2]
+ */
+static inline float playerInterpolateLinear(const int16_t *x, uint32_t frac)
+{
+    const float t = (frac >> 8) * (1.0f / (1 << 24));
+    return x[1] + (x[2] - x[1]) * t;
+}
+
+/* cubic hermite (catmull-rom), passes through the samples and keeps more of the highs than linear */
+static inline float playerInterpolateCubic(const int16_t *x, uint32_t frac)
+{
+    const float t = (frac >> 8) * (1.0f / (1 << 24));
+    const float c1 = 0.5f * (x[2] - x[0]);
+    const float c2 = x[0] - 2.5f * x[1] + 2.0f * x[2] - 0.5f * x[3];
+    const float c3 = 0.5f * (x[3] - x[0]) + 1.5f * (x[1] - x[2]);
+    return ((c3 * t + c2) * t + c1) * t + x[1];
+}
+
+#ifdef PLAYER_INTERPOLATION_LINEAR
+#define playerInterpolate   playerInterpolateLinear
+#else
+#define playerInterpolate   playerInterpolateCubic
+#endif
+
+/* source samples of one resampled chunk and the result, only used by the audio task */
+static int16_t playerResampleSrc[PLAYER_RESAMPLE_CHUNK * PLAYER_RATE_MAX + 4];
+static float playerResampleOut[PLAYER_RESAMPLE_CHUNK];
+
+/*
+ * copies count samples of a playback starting at pos - 1 to dst,
+ * the samples outside of the sample and the ones which were not streamed in time are 0
+ * a loop continues at loopStart behind loopEnd, after a wrap the sample before loopStart is the one at loopEnd - 1,
+ * so the interpolation across the seam uses the neighbours which are played
+ */
+static void playerGather(const struct sample_player *player, const int16_t *streamBuff, uint32_t streamEnd, uint32_t pos, int count, int16_t *dst, bool loop, bool wrapped)
+{
+    const uint32_t stop = loop ? player->loopEnd : player->numSamples;
+    int n = 0;
+    uint32_t s = pos - 1;
+    if (loop && wrapped && (pos == player->loopStart))
+    {
+        int len = 1;
+        const int16_t *src = playerData(player, streamBuff, streamEnd, player->loopEnd - 1, &len);
+        dst[n++] = (src != NULL) ? *src : 0;
+        s = pos;
+    }
+    else if (pos == 0)
+    {
+        dst[n++] = 0;
+        s = pos;
+    }
+
+    while (n < count)
+    {
+        if (s >= stop)
+        {
+            if (!loop)
+            {
+                memset(&dst[n], 0, (count - n) * sizeof(int16_t));
+                break;
+            }
+            s = player->loopStart;
+        }
+        int len = min((uint32_t)(count - n), stop - s);
+        const int16_t *src = playerData(player, streamBuff, streamEnd, s, &len);
+        if (src == NULL)
+        {
+            playerStreamUnderruns++;
+            playerStreamUnderrunSamples += len;
+            memset(&dst[n], 0, len * sizeof(int16_t));
+        }
+        else
+        {
+            memcpy(&dst[n], src, len * sizeof(int16_t));
+        }
+        n += len;
+        s += len;
+    }
+}
+
+/*
+ * resamples a playback into playerResampleOut, the phase pos.frac advances by rate per frame
+ * returns the number of frames (up to PLAYER_RESAMPLE_CHUNK), 0 when end (end of the sample or the loop) is reached
+ * loop: end is the loop end and the interpolation continues at the loop start, wrapped: see playerGather
+ */
+static int playerResample(const struct sample_player *player, const int16_t *streamBuff, uint32_t streamEnd, uint32_t *pos, uint32_t *frac, uint64_t rate, int frames, uint32_t end, bool loop, bool wrapped)
+{
+    if (*pos >= end)
+    {
+        return 0;
+    }
+    frames = min(frames, PLAYER_RESAMPLE_CHUNK);
+
+    /* the division is only needed close to the end */
+    const uint64_t left = (((uint64_t)(end - *pos)) << 32) - *frac;
+    if (left <= frames * rate)
+    {
+        frames = (left + rate - 1) / rate;
+    }
+
+    uint64_t phase = *frac;
+    const int count = (int)((phase + (frames - 1) * rate) >> 32) + 4;
+    playerGather(player, streamBuff, streamEnd, *pos, count, playerResampleSrc, loop, wrapped);
+
+    for (int k = 0; k < frames; k++)
+    {
+        playerResampleOut[k] = playerInterpolate(&playerResampleSrc[phase >> 32], (uint32_t)phase);
+        phase += rate;
+    }
+
+    *pos += (uint32_t)(phase >> 32);
+    *frac = (uint32_t)phase;
+    return frames;
+}
+
+/* last value of a resampled chunk for the fade out at the end of the sample */
+static inline int16_t playerResampleLast(int len)
+{
+    return constrain(playerResampleOut[len - 1], -32768.0f, 32767.0f);
+}
+
+/*
+ * x^n for the multipliers of the envelope, n is at most PLAYER_ENV_BLOCK
+ */
+static inline float playerPowInt(float x, int n)
+{
+    float result = 1.0f;
+    while (n > 0)
+    {
+        if (n & 1)
+        {
+            result *= x;
+        }
+        x *= x;
+        n >>= 1;
+    }
+    return result;
+}
+
+/*
+ * advances the envelope of a voice by len frames
+ * returns false when the voice is not audible anymore (released or decayed below AUDIBLE_LIMIT)
+ */
+static inline bool playerEnvAdvance(struct player_voice_s *voice, int len)
+{
+    const struct player_env_s *env = &voice->player->env;
+    switch (voice->envState)
+    {
+    case player_env_attack:
+        /* multiplier sounds bad so the gain is increased linear here */
+        voice->envGain += env->attack * len;
+        if (voice->envGain >= 1.0f)
+        {
+            voice->envGain = 1.0f;
+            voice->envState = player_env_decay;
+        }
+        return true;
+    case player_env_decay:
+        voice->envGain *= playerPowInt(env->decay, len);
+        if (voice->envGain <= env->sustain)
+        {
+            voice->envGain = env->sustain; /* avoid undershoot */
+            voice->envState = player_env_sustain;
+        }
+        break;
+    case player_env_sustain:
+        voice->envGain = env->sustain;
+        break;
+    case player_env_release:
+        voice->envGain *= playerPowInt(env->release, len);
+        break;
+    }
+    return voice->envGain >= AUDIBLE_LIMIT;
+}
+
+/*
+ * a held note continues at the loop start, pos can be behind the loop end after a start lock
+ */
+static inline void playerVoiceWrap(struct player_voice_s *voice)
+{
+    const struct sample_player *player = voice->player;
+    voice->pos = player->loopStart + (voice->pos - player->loopEnd) % (player->loopEnd - player->loopStart);
+    voice->wrapped = true;
+}
+
+/*
+ * mixes a tail into the frames start..end-1, the gain follows playerFadeLut
+ * the tails are a block operation next to the playback, the mix loop of the voices is not changed
+ */
+static inline void playerMixTail(struct player_tail_s *tail, float *signal_l, float *signal_r, int start, int end)
+{
+    const float gain_l = tail->gain_l;
+    const float gain_r = tail->gain_r;
+    end = min(end, start + tail->left);
+
+    for (int n = start; n < end;)
+    {
+        int len = end - n;
+        const int left = tail->left - 1; /* lut index of the first frame */
+        if (tail->player == NULL)
+        {
+            const float hold = tail->hold;
+            for (int k = 0; k < len; k++)
+            {
+                const float sample_f = hold * playerFadeLut[left - k];
+                signal_l[n + k] += sample_f * gain_l;
+                signal_r[n + k] += sample_f * gain_r;
+            }
+        }
+        else if (tail->rate != PLAYER_RATE_NATIVE)
+        {
+            len = playerResample(tail->player, tail->streamBuff, tail->streamEnd, &tail->pos, &tail->frac, tail->rate, len, tail->player->numSamples, false, false);
+            if (len == 0)
+            {
+                tail->left = 0;
+                return;
+            }
+            for (int k = 0; k < len; k++)
+            {
+                const float sample_f = playerResampleOut[k] * playerFadeLut[left - k];
+                signal_l[n + k] += sample_f * gain_l;
+                signal_r[n + k] += sample_f * gain_r;
+            }
+        }
+        else
+        {
+            if (tail->pos >= tail->player->numSamples)
+            {
+                tail->left = 0;
+                return;
+            }
+            len = min((uint32_t)len, tail->player->numSamples - tail->pos);
+            const int16_t *src = playerData(tail->player, tail->streamBuff, tail->streamEnd, tail->pos, &len);
+            if (src != NULL)
+            {
+                for (int k = 0; k < len; k++)
+                {
+                    const float sample_f = src[k] * playerFadeLut[left - k];
+                    signal_l[n + k] += sample_f * gain_l;
+                    signal_r[n + k] += sample_f * gain_r;
+                }
+            }
+            tail->pos += len;
+        }
+        tail->left -= len;
+        n += len;
+    }
+}
+
+/*
+ * adds len frames of src (samples or resampled values) to the mix, the gains are ramped by step per frame
+ * one shots have a constant gain, their loop is selected at compile time
+ */
+template <bool ramp, typename T>
+static inline void playerMix(const T *src, float *signal_l, float *signal_r, int len, float gain_l, float gain_r, float step_l, float step_r)
+{
+    if (!ramp)
+    {
+        for (int k = 0; k < len; k++)
+        {
+            const float sample_f = src[k];
+            signal_l[k] += sample_f * gain_l;
+            signal_r[k] += sample_f * gain_r;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < len; k++)
+        {
+            const float sample_f = src[k];
+            signal_l[k] += sample_f * gain_l;
+            signal_r[k] += sample_f * gain_r;
+            gain_l += step_l;
+            gain_r += step_r;
+        }
+    }
+}
+
+/*
+ * mixes the frames start..end-1 of a voice, a held note with a loop continues at the loop start
+ * the gains at start are ramped by step per frame
+ * returns the frame where the sample has ended, end when the voice continues
+ * last is the last value mixed, it fades out when the sample has ended
+ */
+template <bool ramp>
+static inline int playerVoiceMix(struct player_voice_s *voice, float *signal_l, float *signal_r, int start, int end, float gain_l, float gain_r, float step_l, float step_r, int16_t *last)
+{
+    struct sample_player *player = voice->player;
+    const bool looping = voice->pressed && (player->loopEnd != 0);
+    const uint32_t voiceEnd = looping ? player->loopEnd : player->numSamples;
+    int n = start;
+
+    if (looping && (voice->pos >= voiceEnd))
+    {
+        playerVoiceWrap(voice);
+    }
+
+    while (n < end)
+    {
+        int len = end - n;
+
+        if (voice->rate == PLAYER_RATE_NATIVE)
+        {
+            len = min((uint32_t)len, voiceEnd - voice->pos);
+            const int16_t *src = playerVoiceData(voice, &len);
+            if (src == NULL)
+            {
+                /* stream underrun, the missing samples are skipped to stay in time */
+                playerStreamUnderruns++;
+                playerStreamUnderrunSamples += len;
+                *last = 0;
+            }
+            else
+            {
+                playerMix<ramp>(src, &signal_l[n], &signal_r[n], len, ramp ? gain_l + step_l * (n - start) : gain_l, ramp ? gain_r + step_r * (n - start) : gain_r, step_l, step_r);
+                *last = src[len - 1];
+            }
+            voice->pos += len;
+        }
+        else
+        {
+            /* pitched, resampled in chunks */
+            len = playerResample(player, voice->streamBuff, playerVoiceStreamEnd(voice), &voice->pos, &voice->frac, voice->rate, len, voiceEnd, looping, voice->wrapped);
+            playerMix<ramp>(playerResampleOut, &signal_l[n], &signal_r[n], len, ramp ? gain_l + step_l * (n - start) : gain_l, ramp ? gain_r + step_r * (n - start) : gain_r, step_l, step_r);
+            *last = playerResampleLast(len);
+        }
+
+        n += len;
+        if (voice->pos >= voiceEnd)
+        {
+            if (!looping)
+            {
+                break;
+            }
+            playerVoiceWrap(voice);
+        }
+    }
+    return n;
+}
+
+/*
+ * the players are processed block wise:
+ * - the frames which can be rendered before the sample ends are mixed in a tight loop,
+ *   pitched voices are resampled in chunks before the same loop
+ * - voices with an envelope are mixed in sub-blocks of PLAYER_ENV_BLOCK frames with a ramped gain
+ * - the tail (retrigger or end of sample) is mixed in a separate loop
+ * - idle voices are skipped, only the voices in playerVoiceMask are loaded
+ */
+void playerProcess(float *signal_l, float *signal_r, const int buffLen)
+{
+    for (int i = 0; i < PLAYER_MAX_TAILS; i++)
+    {
+        if (playerTails[i].left > 0)
+        {
+            playerMixTail(&playerTails[i], signal_l, signal_r, 0, buffLen);
+        }
+    }
+
+    const uint32_t playing = playerVoiceMask;
+    for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+    {
+        if ((playing & (1u << i)) == 0)
+        {
+            continue;
+        }
+        struct player_voice_s *voice = &playerVoices[i];
+        struct sample_player *player = voice->player;
+        const uint8_t pan = playerVoicePan(voice);
+        const float gain = player->velocity * player->gain * voice->velocity / ((float)0x8000);
+        const float gain_l = gain * pan_lut[0][pan];
+        const float gain_r = gain * pan_lut[1][pan];
+        int16_t last = 0;
+        int frames; /* frames rendered from the sample in this block */
+
+        if (voice->envState == player_env_off)
+        {
+            frames = playerVoiceMix<false>(voice, signal_l, signal_r, 0, buffLen, gain_l, gain_r, 0.0f, 0.0f, &last);
+        }
+        else
+        {
+            for (frames = 0; frames < buffLen;)
+            {
+                const int len = min(buffLen - frames, PLAYER_ENV_BLOCK);
+                const float env = voice->envGain;
+                const bool audible = playerEnvAdvance(voice, len);
+                const float step = (voice->envGain - env) / len;
+                const float env_l = gain_l * env;
+                const float env_r = gain_r * env;
+                const int end = frames + len;
+                frames = playerVoiceMix<true>(voice, signal_l, signal_r, frames, end, env_l, env_r, gain_l * step, gain_r * step, &last);
+                if (!audible)
+                {
+                    /* released, the voice is below the audible limit and needs no tail */
+                    playerVoiceStop(voice);
+                    break;
+                }
+                if (frames < end)
+                {
+                    break; /* the sample has ended */
+                }
+            }
+        }
+
+        if (voice->pos >= player->numSamples) /* a stopped voice is at 0 */
+        {
+            /* the last value fades out to avoid a click */
+            struct player_tail_s *tail = playerTailStart(voice, true, last);
+            if (tail != NULL)
+            {
+                playerMixTail(tail, signal_l, signal_r, frames, buffLen);
+            }
+            playerVoiceStop(voice);
+        }
+    }
+    __atomic_store_n(&playerProcessSeq, playerProcessSeq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef PLAYER_FIXED_POINT
+/*
+ * fixed point version of playerMixTail
+ */
+static inline void playerMixTailFixed(struct player_tail_s *tail, int32_t *mix_l, int32_t *mix_r, int start, int end)
+{
+    const int32_t gain_l = tail->gain_l * 0x8000 * 0x8000;
+    const int32_t gain_r = tail->gain_r * 0x8000 * 0x8000;
+    end = min(end, start + tail->left);
+
+    for (int n = start; n < end;)
+    {
+        int len = end - n;
+        const int left = tail->left - 1;
+        if (tail->player == NULL)
+        {
+            const int32_t hold = tail->hold;
+            for (int k = 0; k < len; k++)
+            {
+                const int32_t sample = (hold * playerFadeLutQ15[left - k]) >> 15;
+                mix_l[n + k] += (sample * gain_l) >> PLAYER_MIX_SHIFT;
+                mix_r[n + k] += (sample * gain_r) >> PLAYER_MIX_SHIFT;
+            }
+        }
+        else if (tail->rate != PLAYER_RATE_NATIVE)
+        {
+            len = playerResample(tail->player, tail->streamBuff, tail->streamEnd, &tail->pos, &tail->frac, tail->rate, len, tail->player->numSamples, false, false);
+            if (len == 0)
+            {
+                tail->left = 0;
+                return;
+            }
+            for (int k = 0; k < len; k++)
+            {
+                const int32_t sample = (((int32_t)playerResampleOut[k]) * playerFadeLutQ15[left - k]) >> 15;
+                mix_l[n + k] += (sample * gain_l) >> PLAYER_MIX_SHIFT;
+                mix_r[n + k] += (sample * gain_r) >> PLAYER_MIX_SHIFT;
+            }
+        }
+        else
+        {
+            if (tail->pos >= tail->player->numSamples)
+            {
+                tail->left = 0;
+                return;
+            }
+            len = min((uint32_t)len, tail->player->numSamples - tail->pos);
+            const int16_t *src = playerData(tail->player, tail->streamBuff, tail->streamEnd, tail->pos, &len);
+            if (src != NULL)
+            {
+                for (int k = 0; k < len; k++)
+                {
+                    const int32_t sample = (src[k] * playerFadeLutQ15[left - k]) >> 15;
+                    mix_l[n + k] += (sample * gain_l) >> PLAYER_MIX_SHIFT;
+                    mix_r[n + k] += (sample * gain_r) >> PLAYER_MIX_SHIFT;
+                }
+            }
+            tail->pos += len;
+        }
+        tail->left -= len;
+        n += len;
+    }
+}
+
+/*
+ * fixed point version of playerMix, the Q15 gains are ramped by an integer step per frame
+ * the rounding of the step is below len / 32768 and is reset by the next sub-block
+ */
+template <bool ramp, typename T>
+static inline void playerMixFixed(const T *src, int32_t *mix_l, int32_t *mix_r, int len, int32_t gain_l, int32_t gain_r, int32_t step_l, int32_t step_r)
+{
+    if (!ramp)
+    {
+        for (int k = 0; k < len; k++)
+        {
+            const int32_t sample = src[k];
+            mix_l[k] += (sample * gain_l) >> PLAYER_MIX_SHIFT;
+            mix_r[k] += (sample * gain_r) >> PLAYER_MIX_SHIFT;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < len; k++)
+        {
+            const int32_t sample = src[k];
+            mix_l[k] += (sample * gain_l) >> PLAYER_MIX_SHIFT;
+            mix_r[k] += (sample * gain_r) >> PLAYER_MIX_SHIFT;
+            gain_l += step_l;
+            gain_r += step_r;
+        }
+    }
+}
+
+/*
+ * fixed point version of playerVoiceMix, the interpolated values are rounded towards zero
+ */
+template <bool ramp>
+static inline int playerVoiceMixFixed(struct player_voice_s *voice, int32_t *mix_l, int32_t *mix_r, int start, int end, int32_t gain_l, int32_t gain_r, int32_t step_l, int32_t step_r, int16_t *last)
+{
+    struct sample_player *player = voice->player;
+    const bool looping = voice->pressed && (player->loopEnd != 0);
+    const uint32_t voiceEnd = looping ? player->loopEnd : player->numSamples;
+    int n = start;
+
+    if (looping && (voice->pos >= voiceEnd))
+    {
+        playerVoiceWrap(voice);
+    }
+
+    while (n < end)
+    {
+        int len = end - n;
+
+        if (voice->rate == PLAYER_RATE_NATIVE)
+        {
+            len = min((uint32_t)len, voiceEnd - voice->pos);
+            const int16_t *src = playerVoiceData(voice, &len);
+            if (src == NULL)
+            {
+                /* stream underrun, the missing samples are skipped to stay in time */
+                playerStreamUnderruns++;
+                playerStreamUnderrunSamples += len;
+                *last = 0;
+            }
+            else
+            {
+                playerMixFixed<ramp>(src, &mix_l[n], &mix_r[n], len, ramp ? gain_l + step_l * (n - start) : gain_l, ramp ? gain_r + step_r * (n - start) : gain_r, step_l, step_r);
+                *last = src[len - 1];
+            }
+            voice->pos += len;
+        }
+        else
+        {
+            len = playerResample(player, voice->streamBuff, playerVoiceStreamEnd(voice), &voice->pos, &voice->frac, voice->rate, len, voiceEnd, looping, voice->wrapped);
+            playerMixFixed<ramp>(playerResampleOut, &mix_l[n], &mix_r[n], len, ramp ? gain_l + step_l * (n - start) : gain_l, ramp ? gain_r + step_r * (n - start) : gain_r, step_l, step_r);
+            *last = playerResampleLast(len);
+        }
+
+        n += len;
+        if (voice->pos >= voiceEnd)
+        {
+            if (!looping)
+            {
+                break;
+            }
+            playerVoiceWrap(voice);
+        }
+    }
+    return n;
+}
+
+/*
+ * fixed point version of playerProcess
+ * the players are accumulated in int32 using Q15 gains,
+ * the result has PLAYER_MIX_FRAC_BITS fractional bits and is saturated at the output
+ */
+void playerProcessFixed(int32_t *mix_l, int32_t *mix_r, const int buffLen)
+{
+    for (int i = 0; i < PLAYER_MAX_TAILS; i++)
+    {
+        if (playerTails[i].left > 0)
+        {
+            playerMixTailFixed(&playerTails[i], mix_l, mix_r, 0, buffLen);
+        }
+    }
+
+    const uint32_t playing = playerVoiceMask;
+    for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+    {
+        if ((playing & (1u << i)) == 0)
+        {
+            continue;
+        }
+        struct player_voice_s *voice = &playerVoices[i];
+        struct sample_player *player = voice->player;
+        const uint8_t pan = playerVoicePan(voice);
+        const int32_t pan_l = pan_lut[0][pan] * 0x8000;
+        const int32_t pan_r = pan_lut[1][pan] * 0x8000;
+        /* the gain of the slot can be above 1.0, the products of the gains are calculated in 64 bit */
+        const int32_t gain = player->velocity * player->gain * voice->velocity * 0x8000;
+        const int32_t gain_l = ((int64_t)gain * pan_l) >> 15;
+        const int32_t gain_r = ((int64_t)gain * pan_r) >> 15;
+        int16_t last = 0;
+        int frames;
+
+        if (voice->envState == player_env_off)
+        {
+            frames = playerVoiceMixFixed<false>(voice, mix_l, mix_r, 0, buffLen, gain_l, gain_r, 0, 0, &last);
+        }
+        else
+        {
+            for (frames = 0; frames < buffLen;)
+            {
+                const int len = min(buffLen - frames, PLAYER_ENV_BLOCK);
+                const int32_t env = voice->envGain * 0x8000;
+                const bool audible = playerEnvAdvance(voice, len);
+                const int32_t envEnd = voice->envGain * 0x8000;
+                const int32_t env_l = ((int64_t)gain_l * env) >> 15;
+                const int32_t env_r = ((int64_t)gain_r * env) >> 15;
+                const int32_t step_l = ((((int64_t)gain_l * envEnd) >> 15) - env_l) / len;
+                const int32_t step_r = ((((int64_t)gain_r * envEnd) >> 15) - env_r) / len;
+                const int end = frames + len;
+                frames = playerVoiceMixFixed<true>(voice, mix_l, mix_r, frames, end, env_l, env_r, step_l, step_r, &last);
+                if (!audible)
+                {
+                    /* released, the voice is below the audible limit and needs no tail */
+                    playerVoiceStop(voice);
+                    break;
+                }
+                if (frames < end)
+                {
+                    break; /* the sample has ended */
+                }
+            }
+        }
+
+        if (voice->pos >= player->numSamples) /* a stopped voice is at 0 */
+        {
+            /* the last value fades out to avoid a click */
+            struct player_tail_s *tail = playerTailStart(voice, true, last);
+            if (tail != NULL)
+            {
+                playerMixTailFixed(tail, mix_l, mix_r, frames, buffLen);
+            }
+            playerVoiceStop(voice);
+        }
+    }
+    __atomic_store_n(&playerProcessSeq, playerProcessSeq + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+/*
+ * gain of the tail, linear or equal power (cos) fade out
+ */
+void playerFadeInit(void)
+{
+    for (int n = 0; n < PLAYER_FADE_LEN; n++)
+    {
+        float x = ((float)n) / PLAYER_FADE_LEN; /* n frames left */
+#ifdef PLAYER_FADE_EQUAL_POWER
+        playerFadeLut[n] = sinf(x * (float)M_PI_2);
+#else
+        playerFadeLut[n] = x;
+#endif
+#ifdef PLAYER_FIXED_POINT
+        playerFadeLutQ15[n] = playerFadeLut[n] * 0x8000;
+#endif
+    }
+}
+
+void playerInit()
+{
+    playerFadeInit();
+
+    psramInit();
+    Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
+    Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
+
+    /* the tables of the players are in DRAM, sample data and stream buffers in PSRAM */
+    const uint32_t slotDram = sizeof(samplePlayers) + sizeof(playerSlotFiles);
+    const uint32_t voiceDram = sizeof(playerVoices) + sizeof(playerVoiceMeta) + sizeof(playerVoiceMask) + sizeof(playerTails);
+    const uint32_t mixDram = sizeof(playerResampleSrc) + sizeof(playerResampleOut) + sizeof(playerFadeLut);
+    Serial.printf("Player DRAM: slots %u, voices %u (hot %u), mix %u, total %u bytes\n",
+                  slotDram, voiceDram, (uint32_t)sizeof(playerVoices), mixDram, slotDram + voiceDram + mixDram);
+
+    for (int i = 0; i < PLAYER_MAX_VOICES; i++)
+    {
+        playerVoices[i].streamBuff = (int16_t *)ps_malloc(PLAYER_STREAM_BUFF_LEN * sizeof(int16_t));
+    }
 
     totalSampleStorageLen = ESP.getFreePsram() / sizeof(int16_t);
 }
\ No newline at end of file
@@ -0,0 +1,531 @@
+/*
+ * this file contains the arena for the sample data in PSRAM
+ *
+ * the arena is one block of PSRAM which is split into extents (contiguous ranges of samples)
+ * - all extents are kept in address order, free neighbours are merged
+ * - the free extents are in free lists by size class, an allocation takes the first fitting
+ *   extent of the smallest class which can hold it and gives the rest back
+ * - an extent is referenced by its handle, the address of the data can change (compaction)
+ *
+ * extents are not freed directly, they are retired: readers (the audio task) may still use the data.
+ * SampleArena_Service frees a retired extent when the inUse callback confirms that nobody points into
+ * the data anymore and the reader sequence (counted by the readers) has advanced twice since then
+ *
+ * the compaction moves used extents down into free extents below them in bounded slices:
+ * the data is copied while the readers continue to use the old address, when the copy is done
+ * the new address is published at once (remap callback) and the old range is retired.
+ * the destination never overlaps the source, so the old data stays valid until it is freed
+ *
+ * all functions except SampleArena_Data and SampleArena_Len must be called by the same task,
+ * the data of an extent may only be written while it is pinned (SampleArena_Pin)
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+#define SAMPLE_ARENA_NONE       0 /* no extent, zeroed structs do not own an extent */
+#define SAMPLE_ARENA_ALIGN      16 /* samples, the extents start at 32 byte boundaries */
+#define SAMPLE_ARENA_CLASSES    24 /* free list n holds the extents of 2^n .. 2^(n+1)-1 samples */
+
+static_assert(SAMPLE_ARENA_EXTENTS < 0xFF, "handles are uint8_t");
+
+enum sampleExtentState
+{
+    sample_extent_unused, /* entry of the table is not used */
+    sample_extent_free,
+    sample_extent_used,
+    sample_extent_moving, /* destination of the active move */
+    sample_extent_retired, /* released by its user, readers may still use the data */
+};
+
+struct sample_extent_s
+{
+    int16_t *data;
+    uint32_t len; /* samples, a multiple of SAMPLE_ARENA_ALIGN */
+    uint32_t seq; /* retired: reader sequence when the extent was found unused */
+    uint8_t state; /* enum sampleExtentState */
+    bool unused; /* retired: nobody pointed into the data at seq */
+    bool pinned; /* written by its user, not moved */
+    uint8_t prev; /* neighbours in address order */
+    uint8_t next;
+    uint8_t nextFree; /* next extent in the free list of the size class */
+};
+
+struct sample_arena_s
+{
+    int16_t *base;
+    uint32_t len;
+    struct sample_extent_s ext[SAMPLE_ARENA_EXTENTS + 1]; /* ext[0] is not used, handle 0 is SAMPLE_ARENA_NONE */
+    uint8_t first; /* extent at the lowest address */
+    uint8_t freeList[SAMPLE_ARENA_CLASSES];
+    uint32_t freeMask; /* bit n is set when freeList[n] is not empty */
+    bool compacted; /* no move was found since the last change of the free extents */
+
+    uint8_t moveSrc; /* extent which is moved, SAMPLE_ARENA_NONE when no move is active */
+    uint8_t moveDst;
+    uint32_t moveCopied;
+
+    uint32_t moves;
+    uint32_t movedSamples;
+};
+
+struct sample_arena_s sampleArena;
+
+/* called when the data of an extent got a new address, the users of from must use to */
+void (*sampleArena_remapCb)(const int16_t *from, int16_t *to, uint32_t len) = NULL;
+/* returns true while a reader points into the data */
+bool (*sampleArena_inUseCb)(const int16_t *data, uint32_t len) = NULL;
+
+static inline int SampleArena_Class(uint32_t len)
+{
+    return min(31 - __builtin_clz(len), SAMPLE_ARENA_CLASSES - 1);
+}
+
+static void SampleArena_FreeListAdd(uint8_t h)
+{
+    const int c = SampleArena_Class(sampleArena.ext[h].len);
+    sampleArena.ext[h].nextFree = sampleArena.freeList[c];
+    sampleArena.freeList[c] = h;
+    sampleArena.freeMask |= 1u << c;
+}
+
+static void SampleArena_FreeListRemove(uint8_t h)
+{
+    const int c = SampleArena_Class(sampleArena.ext[h].len);
+    uint8_t *link = &sampleArena.freeList[c];
+    while (*link != h)
+    {
+        link = &sampleArena.ext[*link].nextFree;
+    }
+    *link = sampleArena.ext[h].nextFree;
+    if (sampleArena.freeList[c] == SAMPLE_ARENA_NONE)
+    {
+        sampleArena.freeMask &= ~(1u << c);
+    }
+}
+
+/*
+ * removes an extent from the address order, its range must have been given to a neighbour
+ */
+static void SampleArena_Unlink(uint8_t h)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    if (ext[h].prev != SAMPLE_ARENA_NONE)
+    {
+        ext[ext[h].prev].next = ext[h].next;
+    }
+    else
+    {
+        sampleArena.first = ext[h].next;
+    }
+    if (ext[h].next != SAMPLE_ARENA_NONE)
+    {
+        ext[ext[h].next].prev = ext[h].prev;
+    }
+    ext[h].state = sample_extent_unused;
+}
+
+/*
+ * makes an extent free and merges it with its free neighbours
+ */
+static void SampleArena_Release(uint8_t h)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    const uint8_t next = ext[h].next;
+    const uint8_t prev = ext[h].prev;
+
+    ext[h].state = sample_extent_free;
+    ext[h].pinned = false;
+    if ((next != SAMPLE_ARENA_NONE) && (ext[next].state == sample_extent_free))
+    {
+        SampleArena_FreeListRemove(next);
+        ext[h].len += ext[next].len;
+        SampleArena_Unlink(next);
+    }
+    if ((prev != SAMPLE_ARENA_NONE) && (ext[prev].state == sample_extent_free))
+    {
+        SampleArena_FreeListRemove(prev);
+        ext[prev].len += ext[h].len;
+        SampleArena_Unlink(h);
+        h = prev;
+    }
+    SampleArena_FreeListAdd(h);
+    sampleArena.compacted = false;
+}
+
+static uint8_t SampleArena_NewEntry(void)
+{
+    for (uint8_t h = 1; h <= SAMPLE_ARENA_EXTENTS; h++)
+    {
+        if (sampleArena.ext[h].state == sample_extent_unused)
+        {
+            return h;
+        }
+    }
+    return SAMPLE_ARENA_NONE;
+}
+
+/*
+ * cuts an extent down to len samples, the rest becomes free
+ * when the table is full the extent keeps the rest
+ */
+static void SampleArena_Split(uint8_t h, uint32_t len)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    if (ext[h].len <= len)
+    {
+        return;
+    }
+    const uint8_t n = SampleArena_NewEntry();
+    if (n == SAMPLE_ARENA_NONE)
+    {
+        return;
+    }
+    ext[n].data = ext[h].data + len;
+    ext[n].len = ext[h].len - len;
+    ext[n].prev = h;
+    ext[n].next = ext[h].next;
+    if (ext[h].next != SAMPLE_ARENA_NONE)
+    {
+        ext[ext[h].next].prev = n;
+    }
+    ext[h].next = n;
+    ext[h].len = len;
+    SampleArena_Release(n);
+}
+
+static inline uint32_t SampleArena_Round(uint32_t len)
+{
+    return (len + SAMPLE_ARENA_ALIGN - 1) & ~(SAMPLE_ARENA_ALIGN - 1);
+}
+
+/*
+ * the arena uses len bytes at base, base is aligned to SAMPLE_ARENA_ALIGN samples
+ */
+void SampleArena_Init(void *base, uint32_t len)
+{
+    const uintptr_t align = SAMPLE_ARENA_ALIGN * sizeof(int16_t);
+    const uintptr_t start = ((uintptr_t)base + align - 1) & ~(align - 1);
+
+    memset(&sampleArena, 0, sizeof(sampleArena));
+    sampleArena.base = (int16_t *)start;
+    sampleArena.len = ((len - (start - (uintptr_t)base)) / sizeof(int16_t)) & ~(SAMPLE_ARENA_ALIGN - 1);
+    sampleArena.first = 1;
+    sampleArena.ext[1].data = sampleArena.base;
+    sampleArena.ext[1].len = sampleArena.len;
+    SampleArena_Release(1);
+}
+
+/*
+ * returns the handle of an extent with at least len samples, SAMPLE_ARENA_NONE when there is no space
+ */
+uint8_t SampleArena_Alloc(uint32_t len)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    if ((len == 0) || (len > sampleArena.len))
+    {
+        return SAMPLE_ARENA_NONE;
+    }
+    len = SampleArena_Round(len);
+
+    /* the class of len can contain smaller extents, the higher classes fit in any case */
+    const int c = SampleArena_Class(len);
+    uint8_t h = sampleArena.freeList[c];
+    while ((h != SAMPLE_ARENA_NONE) && (ext[h].len < len))
+    {
+        h = ext[h].nextFree;
+    }
+    if (h == SAMPLE_ARENA_NONE)
+    {
+        const uint32_t higher = sampleArena.freeMask & ~((2u << c) - 1);
+        if (higher == 0)
+        {
+            return SAMPLE_ARENA_NONE;
+        }
+        h = sampleArena.freeList[__builtin_ctz(higher)];
+    }
+
+    SampleArena_FreeListRemove(h);
+    ext[h].state = sample_extent_used;
+    ext[h].pinned = false;
+    SampleArena_Split(h, len);
+    return h;
+}
+
+/*
+ * returns the biggest free extent (for data of unknown length), cut it down with SampleArena_Shrink
+ */
+uint8_t SampleArena_AllocMax(void)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    if (sampleArena.freeMask == 0)
+    {
+        return SAMPLE_ARENA_NONE;
+    }
+    uint8_t best = sampleArena.freeList[31 - __builtin_clz(sampleArena.freeMask)];
+    for (uint8_t h = ext[best].nextFree; h != SAMPLE_ARENA_NONE; h = ext[h].nextFree)
+    {
+        if (ext[h].len > ext[best].len)
+        {
+            best = h;
+        }
+    }
+    SampleArena_FreeListRemove(best);
+    ext[best].state = sample_extent_used;
+    ext[best].pinned = false;
+    return best;
+}
+
+static void SampleArena_AbortMove(void)
+{
+    if (sampleArena.moveSrc != SAMPLE_ARENA_NONE)
+    {
+        SampleArena_Release(sampleArena.moveDst);
+        sampleArena.moveSrc = SAMPLE_ARENA_NONE;
+        sampleArena.moveDst = SAMPLE_ARENA_NONE;
+    }
+}
+
+/*
+ * gives the end of a used extent back, len 0 is not allowed (use SampleArena_Retire)
+ */
+void SampleArena_Shrink(uint8_t h, uint32_t len)
+{
+    if (sampleArena.moveSrc == h)
+    {
+        SampleArena_AbortMove();
+    }
+    SampleArena_Split(h, SampleArena_Round(max(len, (uint32_t)1)));
+}
+
+/*
+ * a pinned extent is written by its user and is not moved, an active move of the extent is cancelled
+ */
+void SampleArena_Pin(uint8_t h, bool pinned)
+{
+    sampleArena.ext[h].pinned = pinned;
+    if (pinned && (sampleArena.moveSrc == h))
+    {
+        SampleArena_AbortMove();
+    }
+    if (!pinned)
+    {
+        sampleArena.compacted = false;
+    }
+}
+
+/*
+ * frees an extent which was never seen by a reader
+ */
+void SampleArena_Free(uint8_t h)
+{
+    if (sampleArena.moveSrc == h)
+    {
+        SampleArena_AbortMove();
+    }
+    SampleArena_Release(h);
+}
+
+/*
+ * releases an extent, it is freed by SampleArena_Service when the readers do not use it anymore
+ */
+void SampleArena_Retire(uint8_t h)
+{
+    if (sampleArena.moveSrc == h)
+    {
+        SampleArena_AbortMove();
+    }
+    sampleArena.ext[h].state = sample_extent_retired;
+    sampleArena.ext[h].pinned = false;
+    sampleArena.ext[h].unused = false;
+}
+
+/*
+ * current address of an extent, can be called from any task
+ */
+inline int16_t *SampleArena_Data(uint8_t h)
+{
+    return __atomic_load_n(&sampleArena.ext[h].data, __ATOMIC_ACQUIRE);
+}
+
+inline uint32_t SampleArena_Len(uint8_t h)
+{
+    return sampleArena.ext[h].len;
+}
+
+/*
+ * free samples in total and in the biggest extent
+ */
+uint32_t SampleArena_FreeTotal(void)
+{
+    uint32_t total = 0;
+    for (uint8_t h = sampleArena.first; h != SAMPLE_ARENA_NONE; h = sampleArena.ext[h].next)
+    {
+        if (sampleArena.ext[h].state == sample_extent_free)
+        {
+            total += sampleArena.ext[h].len;
+        }
+    }
+    return total;
+}
+
+uint32_t SampleArena_FreeMax(void)
+{
+    uint32_t biggest = 0;
+    if (sampleArena.freeMask != 0)
+    {
+        for (uint8_t h = sampleArena.freeList[31 - __builtin_clz(sampleArena.freeMask)]; h != SAMPLE_ARENA_NONE; h = sampleArena.ext[h].nextFree)
+        {
+            biggest = max(biggest, sampleArena.ext[h].len);
+        }
+    }
+    return biggest;
+}
+
+/*
+ * looks for a used extent which fits into a free extent below it, the move copies it there
+ */
+static bool SampleArena_StartMove(void)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    for (uint8_t f = sampleArena.first; f != SAMPLE_ARENA_NONE; f = ext[f].next)
+    {
+        if (ext[f].state != sample_extent_free)
+        {
+            continue;
+        }
+        for (uint8_t u = ext[f].next; u != SAMPLE_ARENA_NONE; u = ext[u].next)
+        {
+            if ((ext[u].state == sample_extent_used) && !ext[u].pinned && (ext[u].len <= ext[f].len))
+            {
+                SampleArena_FreeListRemove(f);
+                ext[f].state = sample_extent_moving;
+                SampleArena_Split(f, ext[u].len);
+                if (ext[f].len != ext[u].len)
+                {
+                    /* the table is full, the rest could not be split off */
+                    SampleArena_Release(f);
+                    return false;
+                }
+                sampleArena.moveSrc = u;
+                sampleArena.moveDst = f;
+                sampleArena.moveCopied = 0;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * the moved extent keeps its handle and gets the range of the destination,
+ * the destination entry takes the old range and is retired
+ */
+static void SampleArena_FinishMove(void)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    const uint8_t a = sampleArena.moveSrc;
+    const uint8_t b = sampleArena.moveDst;
+    int16_t *from = ext[a].data;
+    int16_t *to = ext[b].data;
+
+    /* swap the entries, the links between them are swapped as well */
+    struct sample_extent_s tmp = ext[a];
+    ext[a] = ext[b];
+    ext[b] = tmp;
+    for (int i = 0; i < 2; i++)
+    {
+        const uint8_t h = (i == 0) ? a : b;
+        ext[h].prev = (ext[h].prev == a) ? b : (ext[h].prev == b) ? a : ext[h].prev;
+        ext[h].next = (ext[h].next == a) ? b : (ext[h].next == b) ? a : ext[h].next;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        const uint8_t h = (i == 0) ? a : b;
+        if (ext[h].prev != SAMPLE_ARENA_NONE)
+        {
+            ext[ext[h].prev].next = h;
+        }
+        else
+        {
+            sampleArena.first = h;
+        }
+        if (ext[h].next != SAMPLE_ARENA_NONE)
+        {
+            ext[ext[h].next].prev = h;
+        }
+    }
+
+    ext[a].state = sample_extent_used;
+    ext[a].pinned = false;
+    __atomic_store_n(&ext[a].data, to, __ATOMIC_RELEASE);
+    ext[b].state = sample_extent_retired;
+    ext[b].unused = false;
+    __atomic_store_n(&ext[b].data, from, __ATOMIC_RELEASE);
+
+    if (sampleArena_remapCb != NULL)
+    {
+        sampleArena_remapCb(from, to, ext[a].len);
+    }
+    sampleArena.moves++;
+    sampleArena.movedSamples += ext[a].len;
+    sampleArena.moveSrc = SAMPLE_ARENA_NONE;
+    sampleArena.moveDst = SAMPLE_ARENA_NONE;
+}
+
+/*
+ * background work of the arena, call this regularly from the task which owns the arena
+ * readerSeq is incremented by the reader after each pass over the data, slice is the max. samples copied by this call
+ * - retired extents are freed when nobody points into them and a pass which started later has finished
+ * - the active move is continued, a finished move is published
+ * - otherwise the next move is searched
+ * returns true while there is work left
+ */
+bool SampleArena_Service(const uint32_t *readerSeq, uint32_t slice)
+{
+    struct sample_extent_s *ext = sampleArena.ext;
+    bool busy = false;
+
+    for (uint8_t h = 1; h <= SAMPLE_ARENA_EXTENTS; h++)
+    {
+        if (ext[h].state == sample_extent_retired)
+        {
+            if ((sampleArena_inUseCb != NULL) && sampleArena_inUseCb(ext[h].data, ext[h].len))
+            {
+                ext[h].unused = false;
+            }
+            else if (!ext[h].unused)
+            {
+                /* the pass which runs now can still use the old pointer, the next one can not */
+                ext[h].unused = true;
+                ext[h].seq = __atomic_load_n(readerSeq, __ATOMIC_ACQUIRE);
+            }
+            else if ((int32_t)(__atomic_load_n(readerSeq, __ATOMIC_ACQUIRE) - ext[h].seq) >= 2)
+            {
+                SampleArena_Release(h);
+                continue;
+            }
+            busy = true;
+        }
+    }
+
+    if ((sampleArena.moveSrc == SAMPLE_ARENA_NONE) && !sampleArena.compacted)
+    {
+        sampleArena.compacted = !SampleArena_StartMove();
+    }
+
+    if (sampleArena.moveSrc != SAMPLE_ARENA_NONE)
+    {
+        const uint32_t len = ext[sampleArena.moveSrc].len;
+        const uint32_t n = min(slice, len - sampleArena.moveCopied);
+        memcpy(&ext[sampleArena.moveDst].data[sampleArena.moveCopied], &ext[sampleArena.moveSrc].data[sampleArena.moveCopied], n * sizeof(int16_t));
+        sampleArena.moveCopied += n;
+        if (sampleArena.moveCopied >= len)
+        {
+            SampleArena_FinishMove();
+        }
+        busy = true;
+    }
+    return busy;
+}
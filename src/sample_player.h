@@ -1,13 +1,33 @@
 /*
  * this file contains the implementation of the sampling core
- * a big PSRAM buffer will be allocated
- * you can record to the buffer and playback samples
+ * the records are extents of the sample arena (PSRAM) of player.h
+ * you can record to the arena and playback samples
  * MIDI ch1 noteOn message will trigger different samples
  * MIDI ch2-16 noteOn will trigger each a certain sample with different pitch
  *
  * setting loop start/end is only a rough and crappy implementation
  * - variable/functions name are confusing​
  *
+ * the voices are the ones of player.h, each record is assigned to the slot with the same index
+ *
+ * the records are changed by the control task (midi, ui), the slots and the voices only by the audio task:
+ * the notes are sent with samplerCmdQueue, Sampler_SyncRecord prepares the parameters of a record in
+ * samplerSlotSync and the audio task copies them to the slot between two blocks (Sampler_Process),
+ * so the data of a slot and its gain always change together
+ * the recording works the same way: the audio task writes into the extent it got with the start command
+ * and the control task creates the record when the audio task has applied the stop
+ *
+ * a record refers to its data by the extent handle, the compaction of the arena moves the data.
+ * the control task calls Sampler_Service instead of playerArenaService, the arena is not compacted
+ * while a slot update with the address of the data is on its way
+ *
+ * the sampler is not part of the drum firmware (main.cpp), Core0TaskLoop only calls playerArenaService.
+ * a firmware with the sampler replaces that call with Sampler_Service, host/sampler_check.cpp runs it on the host
+ *
+ * the recorded data is not changed, the peak is measured while recording and the record gets a gain
+ * which is applied at playback. Sampler_NormalizeActiveRecording writes a scaled copy in the background
+ * (Sampler_Service) when the gain should be part of the data (e.g. before saving the patch)
+ *
  * Author: Marcel Licence
  */
 #pragma once
@@ -17,18 +37,27 @@
 #endif
 
 #include "patch_manager.h"
+#include "pitch_table.h"
+#include "player.h"
+#include "audio_command.h"
 
-/* using exp release curve would never reach 0 a defined limit is required */
-#define AUDIBLE_LIMIT   (0.25f/32768.0f)
-
-#define SAMPLE_MAX_RECORDS  32
+/* a record is played by the slot with the same index, the polyphony is PLAYER_MAX_VOICES */
+#ifdef AS5600_ENABLED
+#define SAMPLE_MAX_RECORDS  (NUM_PLAYERS - 1)
+#define SAMPLER_SCRATCH_SLOT    (NUM_PLAYERS - 1)
+#else
+#define SAMPLE_MAX_RECORDS  NUM_PLAYERS
+#endif
 
 #define NOTE_NORMAL 69 /* this is an a -> playback a with original recorded speed */
 
-#define SAMPLE_MAX_PLAYERS  4 /* max polyphony, higher values 'may' not be processed in time */
+#define SAMPLER_SCRATCH_NOTE    0xEE /* ch and note of the scratch voice */
 
 #define MAX_FILENAME_LENGTH	64
 
+#define SAMPLER_GAIN_MAX    64.0f /* +36 dB, quieter records are not normalized completely */
+#define SAMPLER_NORMALIZE_CHUNK 4096 /* samples scaled per call of Sampler_Service */
+
 /*
  * little helpers
  */
@@ -46,24 +75,18 @@ enum samplStatusE
 {
     sampler_idle,
     sampler_rec,
+    sampler_recStop, /* the stop was sent to the audio task, Sampler_Service commits the record */
     sampler_recWait,
     sampler_measureThreshold,
 };
 
-enum sampleADSR
-{
-    adsr_attack,
-    adsr_decay,
-    adsr_sustain,
-    adsr_release,
-};
-
 /*
  * parameters for each sample
  */
 struct sample_record_s
 {
-    uint32_t start;
+    uint8_t extent; /* arena extent of the data, several records can share one (sections) */
+    uint32_t start; /* relative to the data of the extent */
     uint32_t end;
     uint8_t channels;
     bool valid;
@@ -76,37 +99,17 @@ struct sample_record_s
     float sustain;
     float release;
 
-    char filename[MAX_FILENAME_LENGTH];
-};
+    float gain; /* playback level, 1.0 when the data is normalized */
 
-struct sample_player_s
-{
-    struct sample_record_s *sample_rec;
-    int32_t pos;
-    float pos_f;
-    float pitch;
-    bool playing;
-    bool pressed;
-    uint8_t ch;
-    uint8_t note;
-    int normNote;
-    float slow;
-
-    float velocity;
-    float adsr_gain;
-    enum sampleADSR adsr_state;
+    char filename[MAX_FILENAME_LENGTH];
 };
 
 
 struct sample_record_s sampleRecords[SAMPLE_MAX_RECORDS];
-struct sample_player_s samplePlayers[SAMPLE_MAX_PLAYERS];
 
 void (*sampler_recordDoneCb)(void) = NULL;
 
 uint32_t sampleRecordCount = 0; /*!< count of samples in buffer and valid sampleRecords */
-uint32_t sampleStorageInPos = 0; /*!< next free sample in sampleStorage */
-uint32_t sampleStorageLen = 0; /*!< max len of samples storage */
-int16_t *sampleStorage = NULL; /*!< here is were the audio data will be stored */
 
 bool samplerManualRecord = false; /*!< manual record avoids stopping the record by threshold */
 
@@ -117,7 +120,7 @@ float samplerThreshold = 0.02f;
 float inputMonoAbs = 0.0f;
 float inputMaxFiltered = 0;
 
-uint32_t lastIn = 0;
+uint8_t samplerLastExtent = SAMPLE_ARENA_NONE; /*!< extent of the last loaded patch, used by Sampler_AddSection */
 
 bool loop_param_lock = false; /*!< ignore changes of loop start/end when set to true - required for nervous MIDI controllers */
 
@@ -140,10 +143,11 @@ struct sample_record_s scratchRec;
 struct sample_record_s *lastActiveRec = NULL;
 
 /*
- * used for looped playback
+ * used for looped playback, the note of the beat is 0xFF when it was not started
  */
 
-struct sample_player_s *beatPlayer = NULL;
+uint8_t beatCh = 0xFF;
+uint8_t beatNote = 0xFF;
 
 uint8_t sampler_lastCh = 0xFF;
 uint8_t sampler_lastNote = 0xFF;
@@ -154,25 +158,20 @@ void Sampler_Init(void)
     Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
     Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
 
-    sampleStorageLen = ESP.getFreePsram() / sizeof(int16_t);
-
-    sampleStorage = (int16_t *)ps_malloc(sampleStorageLen * sizeof(int16_t));
-    if (sampleStorage == NULL)
-    {
-        Serial.printf("not enough PSRAM memory for sampleStorage!\n");
-    }
+    /* the records are allocated in the sample arena, it takes the free PSRAM */
+    playerArenaInit();
 
     Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
     Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
 
-    Serial.printf("sampleStorageLen: %d\n", sampleStorageLen);
-    Serial.printf("sampleStorageLen: %0.2fs\n", ((float)sampleStorageLen) / ((float)SAMPLE_RATE));
+    playerFadeInit();
+    playerStopAll();
 
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
+    for (int i = 0; i < NUM_PLAYERS; i++)
     {
-        samplePlayers[i].sample_rec = &sampleRecords[i];
-        samplePlayers[i].playing = false;
-        samplePlayers[i].slow = 0.0f;
+        /* the level of a record is its gain, see Sampler_Process for the level of the mix */
+        samplePlayers[i].velocity = 1.0f;
+        samplePlayers[i].pan = 9;
     }
 
     for (int i = 0; i < SAMPLE_MAX_RECORDS; i++)
@@ -182,87 +181,606 @@ void Sampler_Init(void)
         sampleRecords[i].decay = 1.0f;
         sampleRecords[i].attack = 1.0f;
         sampleRecords[i].sustain = 1.0f;
+        sampleRecords[i].gain = 1.0f;
     }
 }
 
-inline
-void Sampler_ProcessADSR(struct sample_player_s *player)
+#ifdef AS5600_ENABLED
+bool scratchActive = false; /* the scratch note was sent */
+float scratchVolume = 1.0f; /* velocity of the scratch note, set by the fader */
+#endif
+
+/* notes and slot updates for the audio task, the control task is the only producer */
+struct audio_cmd_queue_s samplerCmdQueue;
+
+/*
+ * parameters of a slot, prepared by the control task and copied to the slot by the audio task
+ * the next update is prepared when the audio task has applied the previous one (applied == sent)
+ */
+struct sampler_slot_sync_s
+{
+    int16_t *data;
+    uint32_t len;
+    uint32_t loopStart;
+    uint32_t loopEnd;
+    struct player_env_s env;
+    float ratio;
+    float gain;
+    bool enabled;
+    bool dirty; /* the record changed while the previous update was on its way, sent by Sampler_Service */
+    uint32_t sent; /* changed by the control task */
+    uint32_t applied; /* changed by the audio task */
+};
+
+struct sampler_slot_sync_s samplerSlotSync[NUM_PLAYERS];
+
+/*
+ * the recording, the audio task writes the input to the extent which it latched with audio_cmd_record_start
+ * and publishes the length and the peak with the next audio_cmd_record_stop (applied == sent)
+ * the record is created by the control task when the stop was applied, see Sampler_RecordCommit
+ */
+struct sampler_recorder_s
 {
-    switch (player->adsr_state)
+    uint8_t extent; /* pinned extent of the recording, changed by the control task */
+    int16_t *data; /* prepared by the control task before the start is sent */
+    uint32_t len;
+    bool active; /* the audio task writes to data */
+    uint32_t pos; /* samples written, changed by the audio task */
+    int32_t peak;
+    bool stopPending; /* the stop did not fit into the queue, sent by Sampler_Service */
+    uint32_t sent; /* stops sent by the control task */
+    uint32_t applied; /* stops applied by the audio task */
+};
+
+struct sampler_recorder_s samplerRecorder;
+
+/*
+ * slot which plays a record
+ */
+static inline uint8_t Sampler_RecordSlot(const struct sample_record_s *rec)
+{
+#ifdef AS5600_ENABLED
+    if (rec == &scratchRec)
     {
-    case adsr_attack:
-        /* multiplier sounds bad so we should increase gain linear here */
-        player->adsr_gain += player->sample_rec->attack;
-        if (player->adsr_gain >= 1.0f)
+        return SAMPLER_SCRATCH_SLOT;
+    }
+#endif
+    return rec - sampleRecords;
+}
+
+static inline struct sample_record_s *Sampler_SlotRecord(uint8_t slot)
+{
+#ifdef AS5600_ENABLED
+    if (slot == SAMPLER_SCRATCH_SLOT)
+    {
+        return &scratchRec;
+    }
+#endif
+    return &sampleRecords[slot];
+}
+
+/*
+ * current address of the data of a record, the compaction can move it
+ */
+static inline int16_t *Sampler_RecordData(const struct sample_record_s *rec)
+{
+    return SampleArena_Data(rec->extent) + rec->start;
+}
+
+static inline bool Sampler_SyncPending(uint8_t slot)
+{
+    return samplerSlotSync[slot].sent != __atomic_load_n(&samplerSlotSync[slot].applied, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * sends the parameters of a record to its slot, the audio task applies them before its next block
+ * loop and envelope are read by the playing voices, the pitch is used by the next notes
+ */
+void Sampler_SyncRecord(struct sample_record_s *rec)
+{
+    const uint8_t slot = Sampler_RecordSlot(rec);
+    const uint32_t len = rec->end - rec->start;
+    struct sampler_slot_sync_s *sync = &samplerSlotSync[slot];
+
+    if (Sampler_SyncPending(slot))
+    {
+        sync->dirty = true;
+        return;
+    }
+
+    sync->data = Sampler_RecordData(rec);
+    sync->len = len;
+
+    /* the loop plays loop_start..loop_end, a loop behind the end of the record is cut */
+    if ((rec->loop_start >= 0.0f) && (rec->loop_end > rec->loop_start))
+    {
+        sync->loopStart = rec->loop_start;
+        sync->loopEnd = min(rec->loop_end + 1.0f, (float)len);
+    }
+    else
+    {
+        sync->loopStart = 0;
+        sync->loopEnd = 0;
+    }
+
+    sync->env = {true, rec->attack, rec->decay, rec->sustain, rec->release};
+    sync->ratio = rec->pitch;
+    sync->gain = rec->gain;
+    sync->enabled = rec->valid;
+    sync->dirty = false;
+
+    struct audio_cmd_s cmd = {0, audio_cmd_sampler_sync, slot, 0, 0.0f};
+    sync->sent++;
+    if (!AudioCmd_Push(&samplerCmdQueue, &cmd))
+    {
+        sync->sent--;
+        sync->dirty = true;
+    }
+}
+
+/*
+ * copies the prepared parameters to the slot, called by the audio task between two blocks
+ * the tails which fade out the previous data of the slot follow the new gain (normalized data comes with gain 1.0)
+ */
+static void Sampler_ApplySlot(uint8_t slot)
+{
+    struct sampler_slot_sync_s *sync = &samplerSlotSync[slot];
+    struct sample_player *player = &samplePlayers[slot];
+
+    if ((player->sampleStorage != sync->data) && (player->gain > 0.0f))
+    {
+        const float scale = sync->gain / player->gain;
+        for (int i = 0; i < PLAYER_MAX_TAILS; i++)
         {
-            player->adsr_gain = 1.0f;
-            player->adsr_state = adsr_decay;
+            if ((playerTails[i].player == player) && (playerTails[i].left > 0))
+            {
+                playerTails[i].gain_l *= scale;
+                playerTails[i].gain_r *= scale;
+            }
         }
-        break;
-    case adsr_decay:
-        player->adsr_gain *= player->sample_rec->decay;
-        if (player->adsr_gain <= player->sample_rec->sustain)
+    }
+
+    player->sampleStorage = sync->data;
+    player->numSamples = sync->len;
+    player->residentSamples = sync->len;
+    playerSetLoop(slot, sync->loopStart, sync->loopEnd);
+    playerSetEnvelope(slot, &sync->env);
+    playerSetRatio(slot, sync->ratio);
+    playerSetGain(slot, sync->gain);
+    player->enabled = sync->enabled;
+    __atomic_store_n(&sync->applied, sync->applied + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * control task side of the notes, returns false when the queue is full
+ */
+static bool Sampler_SendNote(uint8_t type, uint8_t slot, uint8_t ch, uint8_t note, int cents, float level)
+{
+    struct audio_cmd_s cmd = {0, type, slot, 0, level};
+    cmd.note.ch = ch;
+    cmd.note.note = note;
+    cmd.note.cents = constrain(cents, PLAYER_PITCH_MIN, PLAYER_PITCH_MAX);
+    return AudioCmd_Push(&samplerCmdQueue, &cmd);
+}
+
+static bool Sampler_SendStop(uint8_t slot)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_stop_slot, slot, 0, 0.0f};
+    return AudioCmd_Push(&samplerCmdQueue, &cmd);
+}
+
+/*
+ * applies the notes and slot updates of the control task, called by the audio task before the voices are mixed
+ */
+static void Sampler_Commands(void)
+{
+    struct audio_cmd_s *cmd;
+    while ((cmd = AudioCmd_Peek(&samplerCmdQueue)) != NULL)
+    {
+        switch (cmd->type)
         {
-            player->adsr_state = adsr_sustain;
-            player->adsr_gain = player->sample_rec->sustain; /* avoid undershoot */
+        case audio_cmd_note_on:
+            playerNoteOn(cmd->index, cmd->note.ch, cmd->note.note, cmd->level, cmd->note.cents);
+            break;
+        case audio_cmd_note_off:
+            playerNoteOff(cmd->note.ch, cmd->note.note);
+            break;
+        case audio_cmd_note_velocity:
+            playerNoteVelocity(cmd->note.ch, cmd->note.note, cmd->level);
+            break;
+        case audio_cmd_note_speed:
+            playerNoteSpeed(cmd->note.ch, cmd->note.note, cmd->level);
+            break;
+        case audio_cmd_stop_slot:
+            playerStopSlot(cmd->index);
+            break;
+        case audio_cmd_sampler_sync:
+            Sampler_ApplySlot(cmd->index);
+            break;
+        case audio_cmd_record_start:
+            samplerRecorder.pos = 0;
+            samplerRecorder.peak = 0;
+            samplerRecorder.active = true;
+            break;
+        case audio_cmd_record_stop:
+            samplerRecorder.active = false;
+            __atomic_store_n(&samplerRecorder.applied, samplerRecorder.applied + 1, __ATOMIC_RELEASE);
+            break;
         }
-        break;
-    case adsr_sustain:
-        player->adsr_gain = player->sample_rec->sustain;
-        break;
-    case adsr_release:
-        player->adsr_gain *= player->sample_rec->release;
-        break;
+        AudioCmd_Pop(&samplerCmdQueue);
     }
 }
 
-void Sampler_NormalizeActiveRecording(uint8_t unused, float value)
+/*
+ * playback level which brings the peak to full scale
+ */
+static inline float Sampler_PeakGain(int32_t peak)
 {
-    if ((value > 0) && (lastActiveRec != NULL))
+    return (peak > 0) ? min(32767.0f / peak, SAMPLER_GAIN_MAX) : 1.0f;
+}
+
+/*
+ * appends a block of the input to the active recording (audio task), the peak is updated on the way
+ * the recording stops growing when its extent is full
+ */
+void Sampler_RecordProcess(const float *signal_l, const float *signal_r, const int buffLen)
+{
+    struct sampler_recorder_s *recorder = &samplerRecorder;
+    if (!recorder->active)
     {
-        int16_t maxLvl = 0;
+        return;
+    }
+    const uint32_t len = min((uint32_t)buffLen, recorder->len - recorder->pos);
+    int16_t *data = recorder->data + recorder->pos;
+    int32_t peak = recorder->peak;
 
-        Serial.println("Normalizing sample...");
+    for (uint32_t n = 0; n < len; n++)
+    {
+        const int32_t value = constrain((signal_l[n] + signal_r[n]) * (0.5f * 32767.0f), -32767.0f, 32767.0f);
+        data[n] = value;
+        peak = max(peak, abs(value));
+    }
+    recorder->peak = peak;
+    recorder->pos += len;
+}
+
+static void Sampler_RecordSendStop(void)
+{
+    struct audio_cmd_s cmd = {0, audio_cmd_record_stop, 0, 0, 0.0f};
+    samplerRecorder.stopPending = !AudioCmd_Push(&samplerCmdQueue, &cmd);
+    if (!samplerRecorder.stopPending)
+    {
+        samplerRecorder.sent++;
+    }
+}
+
+/*
+ * creates the record when the audio task has stopped writing, called by Sampler_Service
+ */
+static void Sampler_RecordCommit(void)
+{
+    struct sampler_recorder_s *recorder = &samplerRecorder;
+
+    if (recorder->stopPending)
+    {
+        Sampler_RecordSendStop();
+        return;
+    }
+    if (__atomic_load_n(&recorder->applied, __ATOMIC_ACQUIRE) != recorder->sent)
+    {
+        return;
+    }
+
+    if ((recorder->pos > 0) && (sampleRecordCount < SAMPLE_MAX_RECORDS))
+    {
+        struct sample_record_s *rec = &sampleRecords[sampleRecordCount];
+        rec->extent = recorder->extent;
+        rec->start = 0;
+        rec->end = recorder->pos;
+        rec->gain = Sampler_PeakGain(recorder->peak);
+        rec->valid = true;
+        /* the rest of the extent is given back to the arena */
+        SampleArena_Shrink(rec->extent, rec->end);
+        SampleArena_Pin(rec->extent, false);
+        sampleRecordCount += 1;
+    }
+    else
+    {
+        SampleArena_Free(recorder->extent);
+    }
+    recorder->extent = SAMPLE_ARENA_NONE;
+    sampleStatus = sampler_idle;
+    Serial.println("Recording done!");
+
+    if (sampler_recordDoneCb != NULL)
+    {
+        sampler_recordDoneCb();
+    }
+}
+
+/*
+ * background rewrite of a record with its gain by the control task (Sampler_Service)
+ * requested -> copying -> idle, the copy reaches the slot with Sampler_SyncRecord
+ */
+enum samplerNormalizeState
+{
+    sampler_normalize_idle,
+    sampler_normalize_requested,
+    sampler_normalize_copying,
+};
+
+struct sampler_normalize_s
+{
+    struct sample_record_s *rec;
+    uint8_t src; /* extent and range of the record when the copy was started */
+    uint32_t start;
+    uint32_t len;
+    float gain;
+    uint8_t dst;
+    uint32_t pos; /* samples copied */
+    uint8_t state; /* enum samplerNormalizeState */
+};
+
+struct sampler_normalize_s samplerNormalize;
+
+/*
+ * removal of a record, the last record moves into its slot:
+ * the audio task stops the voices of both slots, the records are changed when the tails have faded out
+ */
+#define SAMPLER_REMOVE_PASSES   (2 + (PLAYER_FADE_LEN + SAMPLE_BUFFER_SIZE - 1) / SAMPLE_BUFFER_SIZE) /* blocks from the stop to the end of the tails */
+
+struct sampler_remove_s
+{
+    struct sample_record_s *rec; /* NULL when no removal is active */
+    struct sample_record_s *moved; /* record which moves into the slot, its voices are stopped as well */
+    uint32_t seq; /* playerProcessSeq when the stop was sent */
+    bool stopped; /* the stop of both slots was sent */
+};
+
+struct sampler_remove_s samplerRemove;
+
+/*
+ * new notes of the records of an active removal are not started
+ */
+static inline bool Sampler_Removing(const struct sample_record_s *rec)
+{
+    return (samplerRemove.rec != NULL) && ((rec == samplerRemove.rec) || (rec == samplerRemove.moved));
+}
+
+static void Sampler_RemoveStop(void)
+{
+    struct sampler_remove_s *job = &samplerRemove;
+    job->moved = (sampleRecordCount > 1) ? &sampleRecords[sampleRecordCount - 1] : job->rec;
+    job->seq = __atomic_load_n(&playerProcessSeq, __ATOMIC_ACQUIRE);
+    job->stopped = Sampler_SendStop(Sampler_RecordSlot(job->rec));
+    if (job->moved != job->rec)
+    {
+        job->stopped &= Sampler_SendStop(Sampler_RecordSlot(job->moved));
+    }
+}
+
+/*
+ * moves the last record into the slot of the removed one
+ * the data is not moved, the extent is released when no other section uses it
+ * and freed by the arena when the audio task does not read it anymore
+ */
+static void Sampler_RemoveFinish(void)
+{
+    struct sample_record_s *rec = samplerRemove.rec;
+    const uint8_t extent = rec->extent;
+    struct sample_record_s *vacated = rec;
+
+    if (sampleRecordCount > 1)
+    {
+        vacated = &sampleRecords[sampleRecordCount - 1];
+        memcpy(rec, vacated, sizeof(struct sample_record_s));
+        sampleRecordCount -= 1;
+        Sampler_SyncRecord(rec);
+    }
+
+    vacated->valid = false;
+    vacated->extent = SAMPLE_ARENA_NONE;
+    vacated->start = 0;
+    vacated->end = 0;
+    Sampler_SyncRecord(vacated);
 
-        for (int i = lastActiveRec->start; i < lastActiveRec->end; i++)
+    bool shared = false;
+    for (uint32_t i = 0; i < sampleRecordCount; i++)
+    {
+        shared |= sampleRecords[i].valid && (sampleRecords[i].extent == extent);
+    }
+    if (!shared)
+    {
+        playerArenaRetire(extent);
+        if (samplerLastExtent == extent)
         {
-            maxLvl = maxI(absI(sampleStorage[i]), maxLvl);
+            samplerLastExtent = SAMPLE_ARENA_NONE;
         }
+    }
+    Serial.println("Record removed...");
+}
 
-        float gainMultiplier = ((float)32767) / ((float)maxLvl);
+/*
+ * scales groups of 8 samples without branches, the compiler turns a group into vector operations
+ * where the target has SIMD, otherwise it keeps the FPU busy without loop overhead
+ * peak * gain is at most full scale, the result does not have to be clipped
+ */
+static void Sampler_ScaleChunk(const int16_t *__restrict src, int16_t *__restrict dst, uint32_t len, float gain)
+{
+    uint32_t n = 0;
+    for (; n + 8 <= len; n += 8)
+    {
+        dst[n + 0] = src[n + 0] * gain;
+        dst[n + 1] = src[n + 1] * gain;
+        dst[n + 2] = src[n + 2] * gain;
+        dst[n + 3] = src[n + 3] * gain;
+        dst[n + 4] = src[n + 4] * gain;
+        dst[n + 5] = src[n + 5] * gain;
+        dst[n + 6] = src[n + 6] * gain;
+        dst[n + 7] = src[n + 7] * gain;
+    }
+    for (; n < len; n++)
+    {
+        dst[n] = src[n] * gain;
+    }
+}
 
-        for (int i = lastActiveRec->start; i < lastActiveRec->end; i++)
+/*
+ * requests the rewrite of the selected record with its gain, the playback level does not change
+ */
+void Sampler_NormalizeActiveRecording(uint8_t unused, float value)
+{
+    if ((value > 0) && (lastActiveRec != NULL) && lastActiveRec->valid && (lastActiveRec->gain != 1.0f))
+    {
+        if (samplerNormalize.state != sampler_normalize_idle)
         {
-            sampleStorage[i] = ((float)sampleStorage[i]) * gainMultiplier;
+            Serial.println("Normalizing is busy");
+            return;
         }
+        Serial.println("Normalizing sample...");
+        samplerNormalize.rec = lastActiveRec;
+        samplerNormalize.state = sampler_normalize_requested;
+    }
+}
+
+/*
+ * publishes a finished rewrite, the copy is dropped when the record was changed in the meantime
+ * the old data is released when no other section uses it, the arena keeps it while the slot points into it
+ */
+static void Sampler_NormalizeFinish(struct sampler_normalize_s *job)
+{
+    struct sample_record_s *rec = job->rec;
+    if (!(rec->valid) || (rec->extent != job->src) || (rec->start != job->start)
+        || (rec->end - rec->start != job->len) || (rec->gain != job->gain))
+    {
+        SampleArena_Free(job->dst);
+        Serial.println("Normalizing cancelled, the record was changed");
+        return;
+    }
 
-        Serial.println("Sample normalized");
+    rec->extent = job->dst;
+    rec->start = 0;
+    rec->end = job->len;
+    rec->gain = 1.0f;
+    Sampler_SyncRecord(rec);
+
+    bool shared = false;
+    for (uint32_t i = 0; i < sampleRecordCount; i++)
+    {
+        shared |= sampleRecords[i].valid && (sampleRecords[i].extent == job->src);
+    }
+    if (!shared)
+    {
+        playerArenaRetire(job->src);
+        if (samplerLastExtent == job->src)
+        {
+            samplerLastExtent = SAMPLE_ARENA_NONE;
+        }
     }
+    Serial.println("Sample normalized");
 }
 
-void Sampler_RecordStop(void)
+/*
+ * background work of the sampler, call this regularly from the control task instead of playerArenaService
+ * - sends the slot updates which had to wait for the previous one
+ * - services the arena while no slot update is on its way
+ * - creates the record of a recording when the audio task has stopped writing it
+ * - finishes a removal when the voices of its slots have faded out
+ * - scales SAMPLER_NORMALIZE_CHUNK samples of a normalization per call
+ */
+void Sampler_Service(void)
 {
-    if (sampleStatus == sampler_rec)
+    struct sampler_normalize_s *job = &samplerNormalize;
+
+    bool pending = false;
+    for (uint8_t slot = 0; slot < NUM_PLAYERS; slot++)
     {
-        if (sampleStorageInPos > sampleRecords[sampleRecordCount].start)
+        if (samplerSlotSync[slot].dirty && !Sampler_SyncPending(slot))
         {
-            sampleRecords[sampleRecordCount].valid = true;
-            sampleRecords[sampleRecordCount].end = sampleStorageInPos;
-            sampleRecordCount += 1;
+            Sampler_SyncRecord(Sampler_SlotRecord(slot));
         }
-        sampleStatus = sampler_idle;
-        Serial.println("Recording done!");
+        pending |= Sampler_SyncPending(slot);
+    }
+    if (!pending)
+    {
+        playerArenaService();
+    }
 
-        struct sample_record_s *tempRec = lastActiveRec;
-        lastActiveRec = &sampleRecords[sampleRecordCount - 1];
-        Sampler_NormalizeActiveRecording(0, 1);
-        lastActiveRec = tempRec;
+    if (sampleStatus == sampler_recStop)
+    {
+        Sampler_RecordCommit();
+    }
 
-        if (sampler_recordDoneCb != NULL)
+    if (samplerRemove.rec != NULL)
+    {
+        /* a record which was added in the meantime is the one which moves */
+        const struct sample_record_s *moved = (sampleRecordCount > 1) ? &sampleRecords[sampleRecordCount - 1] : samplerRemove.rec;
+        if (!samplerRemove.stopped || (moved != samplerRemove.moved))
+        {
+            Sampler_RemoveStop();
+        }
+        else if ((int32_t)(__atomic_load_n(&playerProcessSeq, __ATOMIC_ACQUIRE) - samplerRemove.seq) >= SAMPLER_REMOVE_PASSES)
         {
-            sampler_recordDoneCb();
+            Sampler_RemoveFinish();
+            samplerRemove.rec = NULL;
+            samplerRemove.moved = NULL;
         }
     }
+
+    switch (job->state)
+    {
+    case sampler_normalize_requested:
+        if (!job->rec->valid)
+        {
+            job->state = sampler_normalize_idle;
+            break;
+        }
+        job->src = job->rec->extent;
+        job->start = job->rec->start;
+        job->len = job->rec->end - job->rec->start;
+        job->gain = job->rec->gain;
+        job->dst = SampleArena_Alloc(job->len);
+        if (job->dst == SAMPLE_ARENA_NONE)
+        {
+            Serial.println("No free sample memory to normalize!");
+            job->state = sampler_normalize_idle;
+            break;
+        }
+        /* the copy is written, the source can still be moved by the compaction */
+        SampleArena_Pin(job->dst, true);
+        job->pos = 0;
+        job->state = sampler_normalize_copying;
+        break;
+
+    case sampler_normalize_copying:
+    {
+        const uint32_t len = min((uint32_t)SAMPLER_NORMALIZE_CHUNK, job->len - job->pos);
+        Sampler_ScaleChunk(SampleArena_Data(job->src) + job->start + job->pos, SampleArena_Data(job->dst) + job->pos, len, job->gain);
+        job->pos += len;
+        if (job->pos >= job->len)
+        {
+            SampleArena_Pin(job->dst, false);
+            Sampler_NormalizeFinish(job);
+            job->state = sampler_normalize_idle;
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/*
+ * the record is created by Sampler_Service when the audio task has applied the stop
+ */
+void Sampler_RecordStop(void)
+{
+    if (sampleStatus == sampler_rec)
+    {
+        sampleStatus = sampler_recStop;
+        Sampler_RecordSendStop();
+    }
     else if (sampleStatus == sampler_recWait)
     {
         Serial.println("Recording cancelled!");
@@ -282,198 +800,107 @@ void Sampler_UpdateLoopRange(void)
         lastActiveRec->loop_start = loop_start_c + loop_start_f;
         lastActiveRec->loop_end = loop_len + lastActiveRec->loop_start;
         lastActiveRec->loop_start = min(lastActiveRec->loop_start, lastActiveRec->loop_end);
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
 void Sampler_RecordStart(void)
 {
-    sampleRecords[sampleRecordCount].start = sampleStorageInPos;
+    struct sampler_recorder_s *recorder = &samplerRecorder;
+
+    /* the length is not known, the recording takes the biggest free extent */
+    recorder->extent = SampleArena_AllocMax();
+    if (recorder->extent == SAMPLE_ARENA_NONE)
+    {
+        Serial.println("No free sample memory!");
+        return;
+    }
+    /* the extent is not moved while it is pinned, the audio task keeps its address */
+    SampleArena_Pin(recorder->extent, true);
+    recorder->data = SampleArena_Data(recorder->extent);
+    recorder->len = SampleArena_Len(recorder->extent);
+
+    struct audio_cmd_s cmd = {0, audio_cmd_record_start, 0, 0, 0.0f};
+    if (!AudioCmd_Push(&samplerCmdQueue, &cmd))
+    {
+        SampleArena_Free(recorder->extent);
+        recorder->extent = SAMPLE_ARENA_NONE;
+        Serial.println("Recording not started, the audio task is busy");
+        return;
+    }
     sampleStatus = sampler_rec;
     Serial.println("Recording started..");
 }
 
+/*
+ * the voices are mixed by playerProcess, the stop of a voice fades out its last value (avoids a click)
+ */
 void Sampler_Process(float *signal_l, float *signal_r, const int buffLen)
 {
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
-    {
-        struct sample_player_s *player = &samplePlayers[i];
+    Sampler_Commands();
 
-        for (int n = 0; n < buffLen; n++)
-        {
-            signal_l[n] += player->slow;
-            signal_r[n] += player->slow;
-            player->slow *= 0.99f;
-
-            if (player->playing)
-            {
-                float f2 = player->pos_f;
-                float f1 = 1.0f - f2;
-
-                float sample_f = 0;
-
-                sample_f += f1 * ((float)sampleStorage[player->pos]) / ((float)0x8000);
-                sample_f += f2 * ((float)sampleStorage[player->pos + 1]) / ((float)0x8000);
-
-                sample_f *= player->velocity;
-                /*
-                 * adsr
-                 */
-                sample_f *= player->adsr_gain;
-
-                Sampler_ProcessADSR(player);
-
-                if ((player->pos_f == 0.0f) && (player->pos == 0))
-                {
-                    player->slow -= sample_f;
-                }
-
-                signal_l[n] += sample_f;
-                signal_r[n] += sample_f;
-
-                /* move to next sample */
-                int32_t pitch_u = player->pitch;
-                player->pos_f += player->pitch - pitch_u; /* does not work great when pos_f is bigger */
-                player->pos += pitch_u;
-
-                int posI = player->pos_f;
-                player->pos += posI;
-                player->pos_f -= posI;
-
-                if (player->pressed)
-                {
-                    float sampleLen = player->sample_rec->loop_end - player->sample_rec->loop_start + 1;
-                    /*
-                     * sampleLen = 34896
-                     *
-                     */
-                    if (player->pos - ((float)player->sample_rec->start) >= (player->sample_rec->loop_end))
-                    {
-                        uint32_t sampleLenU = sampleLen;
-                        player->pos -= sampleLenU;
-                        player->pos_f -= sampleLen - sampleLenU;
-                    }
-                }
-
-                /* stop playback when end has been reached */
-                /* stop playback when signal is not audible anymore */
-                if ((player->pos > player->sample_rec->end) || (player->adsr_gain < AUDIBLE_LIMIT))
-                {
-                    player->playing = false;
-                    player->slow += sample_f;
-                }
-            }
-        }
-    }
+    playerProcess(signal_l, signal_r, buffLen);
 
     for (int n = 0; n < buffLen; n++)
     {
         /*
          * make it a bit quieter to avoid distortion in next stage
+         * the center pan of the slots is -3 dB, this gives the level of the mono sampler
          */
-        signal_l[n] *= 0.25f;
-        signal_r[n] *= 0.25f;
+        signal_l[n] *= 0.25f * 1.41421356f;
+        signal_r[n] *= 0.25f * 1.41421356f;
     }
 }
 
-struct sample_player_s *getFreeSamplePlayer(void)
+/*
+ * starts a held note of a record, cents is the pitch relative to the pitch of the record
+ * the note follows the update of the slot in the queue, returns false when it was not sent
+ * or the record is being removed
+ */
+bool Sampler_StartSamplePlayer(struct sample_record_s *rec, uint8_t ch, uint8_t note, float vel, int cents)
 {
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
-    {
-        if (samplePlayers[i].playing == false)
-        {
-            return &samplePlayers[i];
-        }
-    }
-
-    struct sample_player_s *quietestPlayer = NULL;
-    float lowestGain = 1.0f;
-
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
+    if (Sampler_Removing(rec))
     {
-        if (samplePlayers[i].adsr_gain <= lowestGain)
-        {
-            quietestPlayer = &samplePlayers[i];
-            lowestGain = quietestPlayer->adsr_gain;
-        }
+        return false;
     }
-
-    return quietestPlayer;
+    Sampler_SyncRecord(rec);
+    return rec->valid && Sampler_SendNote(audio_cmd_note_on, Sampler_RecordSlot(rec), ch, note, cents, vel);
 }
 
-
-void Sampler_StartSamplePlayer(struct sample_player_s *player, struct sample_record_s *rec)
+inline bool Sampler_NoteOnDrum(uint8_t note)
 {
-    player->sample_rec = rec;
-    player->pos = player->sample_rec->start;
-    player->pos_f = 0.0f;
-    player->playing = true;
-    player->pressed = true;
-    player->pitch = player->sample_rec->pitch;
-
-
-    player->normNote = 0;
-
-    player->adsr_gain = AUDIBLE_LIMIT;
-    player->adsr_state = adsr_attack;
-    Sampler_ProcessADSR(player);
-}
-
-inline struct sample_player_s *Sampler_NoteOnDrum(uint8_t note)
-{
-    struct sample_player_s *freePlayer = NULL;
-
-    freePlayer = &samplePlayers[note];
     struct sample_record_s *rec = &sampleRecords[note];
 
-    Sampler_StartSamplePlayer(freePlayer, rec);
-
-    freePlayer->note = 69;
-    freePlayer->velocity = 1.0f;
-
-    lastActiveRec = freePlayer->sample_rec;
+    lastActiveRec = rec;
 
-return freePlayer;
+    return Sampler_StartSamplePlayer(rec, 0, NOTE_NORMAL, 1.0f, 0);
 }
 
-inline struct sample_player_s *Sampler_NoteOnInt(uint8_t ch, uint8_t note, float vel)
+inline bool Sampler_NoteOnInt(uint8_t ch, uint8_t note, float vel)
 {
-    struct sample_player_s *freePlayer = NULL;
+    bool started = false;
     if (ch == 0)
     {
-        freePlayer = getFreeSamplePlayer();
         struct sample_record_s *rec = &sampleRecords[note % sampleRecordCount];
 
-        if (freePlayer != NULL)
+        started = Sampler_StartSamplePlayer(rec, ch, note, vel, 0);
+        if (started)
         {
-            Sampler_StartSamplePlayer(freePlayer, rec);
-
-            freePlayer->ch = ch;
-            freePlayer->note = note;
-            freePlayer->velocity = vel;
-
-            lastActiveRec = freePlayer->sample_rec;
+            lastActiveRec = rec;
         }
     }
     else
     {
-        freePlayer = getFreeSamplePlayer();
         struct sample_record_s *rec = &sampleRecords[(ch - 1) % sampleRecordCount]; /* decrease by one because we want to start with the first sample here */
 
-        if (freePlayer != NULL)
+        started = Sampler_StartSamplePlayer(rec, ch, note, vel, (note - NOTE_NORMAL) * 100); /* this would be the a as middle */
+        if (started)
         {
-            Sampler_StartSamplePlayer(freePlayer, rec);
-
-            freePlayer->ch = ch;
-            freePlayer->note = note;
-            freePlayer->velocity = vel;
-            freePlayer->normNote = note - NOTE_NORMAL;
-            freePlayer->pitch *= pow(2.0f, 1.0f / 12.0f * (note - NOTE_NORMAL)); /* this would be the a as middle */
-
-            lastActiveRec = freePlayer->sample_rec;
+            lastActiveRec = rec;
         }
     }
 
-    return freePlayer;
+    return started;
 }
 
 void Sampler_NoteOn(uint8_t ch, uint8_t note, float vel)
@@ -486,19 +913,12 @@ void Sampler_NoteOn(uint8_t ch, uint8_t note, float vel)
     sampler_lastCh = ch;
     sampler_lastNote = note;
 
-    (void *)Sampler_NoteOnInt(ch, note, vel);
+    Sampler_NoteOnInt(ch, note, vel);
 }
 
 void Sampler_NoteOff(uint8_t ch, uint8_t note)
 {
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
-    {
-        if ((samplePlayers[i].ch == ch) && (samplePlayers[i].note == note))
-        {
-            samplePlayers[i].pressed = false;
-            samplePlayers[i].adsr_state = adsr_release;
-        }
-    }
+    Sampler_SendNote(audio_cmd_note_off, 0, ch, note, 0, 0.0f);
 }
 
 void Sampler_MeasureThreshold(uint8_t quarter, float value)
@@ -524,7 +944,11 @@ void Sampler_Record(uint8_t quarter, float value)
         if (sampleRecordCount < SAMPLE_MAX_RECORDS)
         {
             samplerManualRecord = true;
-            if (sampleStatus != sampler_rec)
+            if (sampleStatus == sampler_recStop)
+            {
+                Serial.println("Previous recording is not done yet");
+            }
+            else if (sampleStatus != sampler_rec)
             {
                 Sampler_RecordStart();
             }
@@ -548,9 +972,9 @@ void Sampler_Stop(uint8_t quarter, float value)
         samplerManualRecord = false;
         Sampler_RecordStop();
 
-        if (beatPlayer != NULL)
+        if (beatCh != 0xFF)
         {
-            Sampler_NoteOff(beatPlayer->ch, beatPlayer->note);
+            Sampler_NoteOff(beatCh, beatNote);
         }
     }
 }
@@ -562,20 +986,22 @@ void Sampler_Play(uint8_t unused, float value)
         if (sampler_lastCh != 0xFF)
         {
             struct sample_record_s *tempActiveRec = lastActiveRec;
-            beatPlayer = Sampler_NoteOnInt(sampler_lastCh, sampler_lastNote, 1);
+            if (Sampler_NoteOnInt(sampler_lastCh, sampler_lastNote, 1))
+            {
+                beatCh = sampler_lastCh;
+                beatNote = sampler_lastNote;
+            }
             lastActiveRec = tempActiveRec;
         }
     }
 }
 
 #ifdef AS5600_ENABLED
-struct sample_player_s *scratchPlayer = NULL;
-
 void Sampler_SetScratchSample(uint8_t selSample, float value)
 {
     if (value > 0)
     {
-        Sampler_NoteOff(0xEE, 0xEE);
+        Sampler_NoteOff(SAMPLER_SCRATCH_NOTE, SAMPLER_SCRATCH_NOTE);
 
         if (selSample == 0xFF)
         {
@@ -595,23 +1021,13 @@ void Sampler_SetScratchSample(uint8_t selSample, float value)
         scratchRec.release = 0;
         scratchRec.pitch = 0;
 
-        {
-            scratchPlayer = getFreeSamplePlayer();
-            struct sample_record_s *rec = &scratchRec;
-
-            if (scratchPlayer != NULL)
-            {
-                Sampler_StartSamplePlayer(scratchPlayer, rec);
+        /* the scratch note starts with the first forward speed (Sampler_SetPitchAbs) */
+        scratchActive = false;
 
-                scratchPlayer->ch = 0xEE;
-                scratchPlayer->note = 0xEE;
-                scratchPlayer->velocity = 1;
 #ifdef DISPLAY_160x80_ENABLED
-                Display_SetFullText(scratchRec.filename);
-                Display_Redraw();
+        Display_SetFullText(scratchRec.filename);
+        Display_Redraw();
 #endif
-            }
-        }
     }
 }
 
@@ -623,9 +1039,10 @@ void Sampler_ScratchFader(uint8_t unused, float value)
     {
         vol = 1;
     }
-    if (scratchPlayer != NULL)
+    scratchVolume = vol;
+    if (scratchActive)
     {
-        scratchPlayer->velocity = vol;
+        Sampler_SendNote(audio_cmd_note_velocity, 0, SAMPLER_SCRATCH_NOTE, SAMPLER_SCRATCH_NOTE, 0, vol);
     }
 
     vol = 1.0f - value;
@@ -635,9 +1052,9 @@ void Sampler_ScratchFader(uint8_t unused, float value)
         vol = 1;
     }
 
-    if (beatPlayer != NULL)
+    if (beatCh != 0xFF)
     {
-        beatPlayer->velocity = vol;
+        Sampler_SendNote(audio_cmd_note_velocity, 0, beatCh, beatNote, 0, vol);
     }
 }
 #endif
@@ -687,10 +1104,10 @@ void Sampler_LoopEndC(uint8_t quarter, float value)
      */
     float samples_a440 = (1.0f / 440.0f) * 44100.0f;
 
-    samples_a440 *= 1.0f / pow(2.0f, (value * 8.0) - 4.0f);
+    samples_a440 *= Pitch_Exp2(4.0f - (value * 8.0f));
 
     loop_end_c = samples_a440;
-    loop_end_c = 1.0f / pow(2.0f, (value / 0.5f)); /* two octaves */
+    loop_end_c = Pitch_Exp2(-(value / 0.5f)); /* two octaves */
     Sampler_UpdateLoopRange();
     if (lastActiveRec != NULL)
     {
@@ -705,7 +1122,7 @@ void Sampler_LoopEndF(uint8_t quarter, float value)
         return;
     }
 
-    loop_end_f = 1.0f / pow(2.0f, (value / 24.0f)); /* quarter note */
+    loop_end_f = Pitch_Exp2(-(value / 24.0f)); /* quarter note */
     Sampler_UpdateLoopRange();
     if (lastActiveRec != NULL)
     {
@@ -721,6 +1138,7 @@ void Sampler_LoopAll(uint8_t index, float value)
 
         lastActiveRec->loop_start = 0;
         lastActiveRec->loop_end = sampleLen - 1;
+        Sampler_SyncRecord(lastActiveRec);
 
         Serial.printf("len %.3f\n", lastActiveRec->end - lastActiveRec->start);
         Serial.printf("loop_start %.3f\n", lastActiveRec->loop_start);
@@ -752,6 +1170,7 @@ void Sampler_LoopRemove(uint8_t index, float value)
     {
         lastActiveRec->loop_start = lastActiveRec->end;
         lastActiveRec->loop_end = lastActiveRec->end;
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
@@ -770,15 +1189,39 @@ void Sampler_SetPitch(uint8_t quarter, float value)
 {
     if (lastActiveRec != NULL)
     {
-        lastActiveRec->pitch = 0.5f * pow(2.0f, 2.0f * value);
+        lastActiveRec->pitch = Pitch_Exp2(2.0f * value - 1.0f);
+        Sampler_SyncRecord(lastActiveRec);
         Serial.printf("pitch %.3f\n", lastActiveRec->pitch);
     }
 }
 
 #ifdef AS5600_ENABLED
+/*
+ * speed of the scratch voice, the voices do not play backwards:
+ * at 0 and below the voice is stopped (it fades out), the next forward speed starts it again from the beginning
+ */
 void Sampler_SetPitchAbs(float value)
 {
     scratchRec.pitch = value;
+    if (!scratchRec.valid)
+    {
+        return;
+    }
+    if (value > 0.0f)
+    {
+        if (scratchActive)
+        {
+            Sampler_SendNote(audio_cmd_note_speed, 0, SAMPLER_SCRATCH_NOTE, SAMPLER_SCRATCH_NOTE, 0, value);
+        }
+        else
+        {
+            scratchActive = Sampler_StartSamplePlayer(&scratchRec, SAMPLER_SCRATCH_NOTE, SAMPLER_SCRATCH_NOTE, scratchVolume, 0);
+        }
+    }
+    else if (scratchActive)
+    {
+        scratchActive = !Sampler_SendNote(audio_cmd_note_speed, 0, SAMPLER_SCRATCH_NOTE, SAMPLER_SCRATCH_NOTE, 0, 0.0f);
+    }
 }
 #endif
 
@@ -824,20 +1267,17 @@ void Sampler_PitchBend(uint8_t ch, float bend)
 
 void Sampler_Panic(uint8_t ch, float value)
 {
-    for (int i = 0; i < SAMPLE_MAX_PLAYERS; i++)
+    for (uint8_t slot = 0; slot < NUM_PLAYERS; slot++)
     {
-        if ((samplePlayers[i].ch != 0xEE) && (samplePlayers[i].note != 0xEE)) /* do not kill scratch sample */
+#ifdef AS5600_ENABLED
+        if (slot == SAMPLER_SCRATCH_SLOT)
         {
-            if (samplePlayers[i].playing)
-            {
-                /* show information about stuck notes */
-                Serial.printf("KillNote %d\n", i);
-            }
-            samplePlayers[i].pressed = false;
-            samplePlayers[i].playing = false;
-            Serial.println("Panic! All notes off...");
+            continue; /* do not kill scratch sample */
         }
+#endif
+        Sampler_SendStop(slot);
     }
+    Serial.println("Panic! All notes off...");
 }
 
 void Sampler_RemoveActiveRecording(uint8_t unused, float value)
@@ -849,34 +1289,16 @@ void Sampler_RemoveActiveRecording(uint8_t unused, float value)
             Serial.println("No record selected for removal");
             return;
         }
-        Serial.println("Erasing record...");
-        uint32_t recordLength = lastActiveRec->end - lastActiveRec->start;
-        for (int i = lastActiveRec->start; i + recordLength < sampleStorageLen; i++)
-        {
-            sampleStorage[i] = sampleStorage[i + recordLength];
-        }
-        sampleStorageInPos -= recordLength;
-
-        for (int i = 0; i < sampleRecordCount; i++)
+        if (samplerRemove.rec != NULL)
         {
-            if (sampleRecords[i].start > lastActiveRec->start)
-            {
-                sampleRecords[i].start -= recordLength;
-                sampleRecords[i].end -= recordLength;
-            }
-        }
-
-        lastActiveRec->valid = false;
-
-        if (sampleRecordCount > 1)
-        {
-            memcpy(lastActiveRec, &sampleRecords[sampleRecordCount - 1], sizeof(struct sample_record_s));
-            sampleRecords[sampleRecordCount - 1].valid = false;
-            sampleRecordCount -= 1;
+            Serial.println("Removing is busy");
+            return;
         }
-
+        Serial.println("Erasing record...");
+        /* only the voices of the removed and of the moved record are stopped, the rest is done by Sampler_Service */
+        samplerRemove.rec = lastActiveRec;
+        Sampler_RemoveStop();
         lastActiveRec = NULL;
-        Serial.println("Record removed...");
     }
 }
 
@@ -888,7 +1310,7 @@ void Sampler_SavePatch(uint8_t quarter, float value)
         {
             struct patchParam_s patchParam;
             memset(&patchParam, 0, sizeof(patchParam));
-            patchParam.version = 1;
+            patchParam.version = 2;
 
             patchParam.patchParamV0.pitch = lastActiveRec->pitch;
             patchParam.patchParamV0.loop_start = lastActiveRec->loop_start;
@@ -899,7 +1321,9 @@ void Sampler_SavePatch(uint8_t quarter, float value)
             patchParam.patchParamV1.sustain = lastActiveRec->sustain;
             patchParam.patchParamV1.release = lastActiveRec->release;
 
-            PatchManager_SaveNewPatch(&patchParam, &sampleStorage[lastActiveRec->start], lastActiveRec->end - lastActiveRec->start);
+            patchParam.patchParamV2.gain = lastActiveRec->gain;
+
+            PatchManager_SaveNewPatch(&patchParam, Sampler_RecordData(lastActiveRec), lastActiveRec->end - lastActiveRec->start);
             //PatchManager_SaveNewPatch(lastActiveRec, sampleStorage);
         }
     }
@@ -911,10 +1335,31 @@ void Sampler_LoadPatch(uint8_t unused, float value)
     {
         struct patchParam_s patchParam;
 
-        uint32_t newSampleLen = PatchManager_LoadPatch(&patchParam, &sampleStorage[sampleStorageInPos], sampleStorageLen - sampleStorageInPos);
+        /* each record has its own slot */
+        if (sampleRecordCount >= SAMPLE_MAX_RECORDS)
+        {
+            Serial.println("No free sample handlers available!");
+            lastActiveRec = NULL;
+            return;
+        }
+
+        /* the length is not known before, the patch is loaded into the biggest free extent */
+        const uint8_t extent = SampleArena_AllocMax();
+        if (extent == SAMPLE_ARENA_NONE)
+        {
+            Serial.println("No free sample memory!");
+            lastActiveRec = NULL;
+            return;
+        }
+        SampleArena_Pin(extent, true);
+
+        uint32_t newSampleLen = PatchManager_LoadPatch(&patchParam, SampleArena_Data(extent), SampleArena_Len(extent));
 
         if (newSampleLen > 0)
         {
+            SampleArena_Shrink(extent, newSampleLen);
+            SampleArena_Pin(extent, false);
+
             struct sample_record_s *newPatch = &sampleRecords[sampleRecordCount];
             sampleRecordCount++;
 
@@ -939,17 +1384,20 @@ void Sampler_LoadPatch(uint8_t unused, float value)
                 newPatch->release = 1.0f;
             }
 
-            newPatch->start = sampleStorageInPos;
-            newPatch->end = newPatch->start + newSampleLen;
+            newPatch->gain = (patchParam.version >= 2) ? patchParam.patchParamV2.gain : 1.0f;
+
+            newPatch->extent = extent;
+            newPatch->start = 0;
+            newPatch->end = newSampleLen;
             newPatch->valid = true;
-            lastIn = sampleStorageInPos;
-            sampleStorageInPos += newSampleLen;
+            samplerLastExtent = extent;
 
             /* select new recorded sample */
             lastActiveRec = newPatch;
         }
         else
         {
+            SampleArena_Free(extent);
             lastActiveRec = NULL;
         }
     }
@@ -965,7 +1413,7 @@ void Sampler_SetADSR_Attack(uint8_t not_used, float value)
 {
     if (lastActiveRec != NULL)
     {
-        float attackInv = pow(2.0f, value * 4) - 1.0f;
+        float attackInv = Pitch_Exp2(value * 4) - 1.0f;
         if (attackInv > 0.0f)
         {
             lastActiveRec->attack = 1 / (attackInv * 44100.0f);
@@ -974,6 +1422,7 @@ void Sampler_SetADSR_Attack(uint8_t not_used, float value)
         {
             lastActiveRec->attack = 1 / AUDIBLE_LIMIT;
         }
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
@@ -981,7 +1430,8 @@ void Sampler_SetADSR_Decay(uint8_t not_used, float value)
 {
     if (lastActiveRec != NULL)
     {
-        lastActiveRec->decay = pow(value, 10.0f / 44100.0f); /* value controls the level after one tenth of a second */
+        lastActiveRec->decay = Pitch_Pow(value, 10.0f / 44100.0f); /* value controls the level after one tenth of a second */
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
@@ -989,7 +1439,8 @@ void Sampler_SetADSR_Release(uint8_t not_used, float value)
 {
     if (lastActiveRec != NULL)
     {
-        lastActiveRec->release = pow(value, 10.0f / 44100.0f); /* value controls the level after one tenth of a second */
+        lastActiveRec->release = Pitch_Pow(value, 10.0f / 44100.0f); /* value controls the level after one tenth of a second */
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
@@ -998,6 +1449,7 @@ void Sampler_SetADSR_Sustain(uint8_t not_used, float value)
     if (lastActiveRec != NULL)
     {
         lastActiveRec->sustain = value;
+        Sampler_SyncRecord(lastActiveRec);
     }
 }
 
@@ -1006,17 +1458,28 @@ void Sampler_SetRecordDoneCallback(void(*callback)(void))
     sampler_recordDoneCb = callback;
 }
 
+/*
+ * adds a record which plays a section of the last loaded patch,
+ * the section is skipped when all slots are used (the data stays with the patch)
+ */
 void Sampler_AddSection(float pitch_keycenter, uint32_t  offset, uint32_t  end, uint32_t  loop_start, uint32_t loop_end, const char *soundName)
 {
+    if (sampleRecordCount >= SAMPLE_MAX_RECORDS)
+    {
+        Serial.printf("No free sample handler for section %s\n", soundName);
+        return;
+    }
+
     struct sample_record_s *newPatch = &sampleRecords[sampleRecordCount];
     sampleRecordCount++;
 
     memset(newPatch->filename, 0, MAX_FILENAME_LENGTH);
     memcpy(newPatch->filename, soundName, strnlen(soundName, MAX_FILENAME_LENGTH));
 
-    newPatch->pitch = ((pow(2.0f, (69.0f - ((float)pitch_keycenter)) / 12.0f)));
-    newPatch->start = lastIn + offset;
-    newPatch->end = lastIn + end;
+    newPatch->pitch = Pitch_Exp2((69.0f - ((float)pitch_keycenter)) / 12.0f);
+    newPatch->extent = samplerLastExtent;
+    newPatch->start = offset;
+    newPatch->end = end;
 
     if ((offset ==  loop_start) && (end == (loop_end + 1)))
     {
@@ -1033,6 +1496,7 @@ void Sampler_AddSection(float pitch_keycenter, uint32_t  offset, uint32_t  end,
     newPatch->attack = 1;
     newPatch->decay = 1;
     newPatch->release = 0.99;
+    newPatch->gain = 1.0f;
 
     newPatch->valid = true;
 }
\ No newline at end of file
@@ -0,0 +1,440 @@
+/*
+ * this file contains the euclidean sequencer
+ *
+ * the sequencer runs in the audio task and is clocked by the rendered audio frames:
+ * - internal clock: the tick length is kept in frames with 32 fractional bits,
+ *   every tick is exact to the sample and the tempo does not drift
+ * - midi clock: the timestamped pulses are converted into frames and smoothed by a PLL (clock_follower.h),
+ *   the steps are scheduled AUDIO_CMD_LATENCY after the filtered pulse
+ *
+ * the triggers are queued with their frame, the ui on core 0 only redraws when sequencerStepChanged is set
+ *
+ * the rings the tick plays (sequencerRings) are only changed by the audio task, the ui keeps its own
+ * copy in ringStates and sends the edits with sequencerCmdQueue, a pattern is sent together with its length,
+ * so a tick never sees a half written pattern, the ui only reads activeNote back
+ *
+ * every ring has its own length of up to SEQ_MAX_STEPS steps (polymeter), bit n of the
+ * pattern is step n, so a step is a single bit test in the tick
+ *
+ * a step can have parameter locks (velocity, pan, start, pitch, probability), they are sent like the ring edits
+ * and resolved once per trigger: the probability in the tick, the others when the audio task starts the voice
+ *
+ * swing (global or per ring) delays the odd steps of a ring, micro timing moves single steps
+ * by up to SEQ_MICRO_TIMING_MAX frames, both only change the frame of the queued trigger:
+ * the internal clock runs SEQ_MICRO_TIMING_MAX frames ahead of the audio, so a step can also
+ * be early, the triggers are queued sorted by their frame
+ *
+ * the tuning of a ring (sequencerSendTune) is added to the pitch lock of the steps, a tuned ring always plays pitched
+ *
+ * a ratchet repeats the trigger of a step evenly within the step and fades out the previous voice
+ * of the slot (PLAYER_LOCK_RETRIGGER), only the first trigger is queued with the step, the repeats
+ * are kept in sequencerRatchets and queued in the block they are due, so the local queue only holds
+ * the triggers of the lookahead and does not fill up when all rings play the maximum of ratchets
+ *
+ * the sequencer is shared between the firmware and the host tools
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "audio_command.h"
+#include "clock_follower.h"
+
+#ifndef RINGS
+#define RINGS 4
+#endif
+
+#define SEQ_MAX_STEPS   64 /* steps in a uint64_t pattern */
+
+#ifndef SEQ_MICRO_TIMING_MAX
+#define SEQ_MICRO_TIMING_MAX    1024 /* frames a step can be moved, also the lookahead of the internal clock */
+#endif
+#define SEQ_RATCHET_MAX 8 /* triggers in one step */
+#define SEQ_RATCHET_STEPS   4 /* steps of a ring which can have repeats left */
+#define SEQ_SWING_MIN   50 /* percent, straight */
+#define SEQ_SWING_MAX   75
+
+const uint8_t divRatio[5] = {16, 8, 4, 2, 1}; //note multipliers = "1","2","4","8","16","32"
+
+/* the ring as edited by the ui */
+struct ringState
+{
+  byte mode;
+  byte loopLength;
+  byte numNotes;
+  byte offset;
+  int8_t clkDiv;
+  uint64_t userNotes;
+  uint64_t euclidNotes;
+  int8_t panValue;
+  int8_t vol;
+};
+
+/* the ring as played by the sequencer, only changed by the audio task */
+struct seq_ring_s
+{
+  int8_t activeNote;
+  uint8_t loopLength;
+  int8_t clkDiv;
+  bool hold; /* the button of the ring is pressed, every step plays */
+  uint8_t swing; /* percent, 0 uses sequencerSwing */
+  int8_t tune; /* semitones added to the pitch of every step */
+  int8_t fine; /* cents */
+  uint64_t euclidNotes;
+};
+
+/*
+ * locks of one step, lock.flags tells which values are used (PLAYER_LOCK_* and SEQ_LOCK_PROBABILITY)
+ */
+#define SEQ_LOCK_PROBABILITY    0x80
+
+struct seq_step_s
+{
+  struct player_lock_s lock;
+  uint8_t probability; /* percent */
+  int16_t microTiming; /* frames, -SEQ_MICRO_TIMING_MAX..SEQ_MICRO_TIMING_MAX */
+  uint8_t ratchet; /* triggers in the step, 0 and 1: single trigger */
+};
+
+/* the repeats left of a ratcheted step */
+struct seq_ratchet_s
+{
+  struct audio_cmd_s cmd; /* the trigger of the step with PLAYER_LOCK_RETRIGGER */
+  uint64_t due; /* frame of the step with 32 fractional bits, without micro timing */
+  uint64_t stepLen;
+  int32_t micro;
+  uint8_t ratchet; /* triggers in the step */
+  uint8_t next; /* next repeat, the entry is free when it reached ratchet */
+};
+
+ringState ringStates[RINGS];
+struct seq_ring_s sequencerRings[RINGS];
+struct seq_step_s sequencerSteps[RINGS][SEQ_MAX_STEPS]; /* only changed by the audio task like sequencerRings */
+
+const uint8_t max_div = 16;
+uint8_t seq_counter = 1;
+
+volatile bool midi_clock = false;
+volatile uint8_t bpm = 120;
+uint8_t sequencerSwing = SEQ_SWING_MIN; /* percent, used by the rings without their own swing */
+uint8_t pulse_counter = 0;
+
+/* midi pulses per tick, a tick is a 16th note like the internal clock */
+#define SEQ_MIDI_PULSES_PER_TICK    (CLOCK_FOLLOWER_PPQN / 4)
+
+struct clock_follower_s midiClockFollower;
+
+volatile bool sequencerStepChanged = false; /* set when the ui should show the new steps */
+
+/* midi realtime messages from the midi task */
+struct audio_cmd_queue_s midiCmdQueue;
+
+/* ring edits from the ui task */
+struct audio_cmd_queue_s sequencerCmdQueue;
+
+uint64_t sequencerNextTick = 0; /* frame of the next internal tick, 32 fractional bits */
+
+struct seq_ratchet_s sequencerRatchets[RINGS][SEQ_RATCHET_STEPS]; /* only used by the audio task */
+uint32_t sequencerRatchetsDropped = 0; /* repeats cut off because all entries of the ring were used */
+
+uint32_t sequencerRandomState = 1; /* xorshift, the same seed gives the same pattern in the host tools */
+
+/*
+ * ui side, the edits are applied by the audio task before its next tick
+ * returns false when the queue is full
+ */
+bool sequencerSendPattern(uint8_t ring, uint8_t loopLength, uint64_t pattern)
+{
+  struct audio_cmd_s cmd = {0, audio_cmd_seq_pattern, ring, loopLength, 0.0f};
+  cmd.pattern = pattern;
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+bool sequencerSendDiv(uint8_t ring, int8_t clkDiv)
+{
+  struct audio_cmd_s cmd = {0, audio_cmd_seq_div, ring, (uint8_t)clkDiv, 0.0f};
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+bool sequencerSendHold(uint8_t ring, bool hold)
+{
+  struct audio_cmd_s cmd = {0, audio_cmd_seq_hold, ring, hold, 0.0f};
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+/* the whole step is replaced at once, the micro timing is sent in the frame of the command */
+bool sequencerSendLock(uint8_t ring, uint8_t step, const struct seq_step_s *lock)
+{
+  struct audio_cmd_s cmd = {(uint32_t)(int32_t)lock->microTiming, audio_cmd_seq_lock, ring, step, 0.0f};
+  cmd.step.lock = lock->lock;
+  cmd.step.probability = lock->probability;
+  cmd.step.ratchet = lock->ratchet;
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+bool sequencerSendClearLocks(uint8_t ring)
+{
+  struct audio_cmd_s cmd = {0, audio_cmd_seq_clear, ring, 0, 0.0f};
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+bool sequencerSendTune(uint8_t ring, int8_t semitones, int8_t cents)
+{
+  struct audio_cmd_s cmd = {0, audio_cmd_seq_tune, ring, 0, 0.0f};
+  cmd.lock.pitch = semitones;
+  cmd.lock.fine = cents;
+  return AudioCmd_Push(&sequencerCmdQueue, &cmd);
+}
+
+static inline uint32_t sequencerRandom(void)
+{
+  sequencerRandomState ^= sequencerRandomState << 13;
+  sequencerRandomState ^= sequencerRandomState >> 17;
+  sequencerRandomState ^= sequencerRandomState << 5;
+  return sequencerRandomState;
+}
+
+/*
+ * keeps the repeats of a step, a free entry is used or else the one which ends first is cut off
+ */
+static void sequencerAddRatchet(int ring, const struct audio_cmd_s *cmd, uint64_t due, uint64_t stepLen, int32_t micro, uint8_t ratchet)
+{
+  struct seq_ratchet_s *entry = &sequencerRatchets[ring][0];
+  for (int n = 0; n < SEQ_RATCHET_STEPS; n++)
+  {
+    struct seq_ratchet_s *e = &sequencerRatchets[ring][n];
+    if (e->next >= e->ratchet)
+    {
+      entry = e;
+      break;
+    }
+    if (e->due + e->stepLen < entry->due + entry->stepLen)
+    {
+      entry = e;
+    }
+  }
+  if (entry->next < entry->ratchet)
+  {
+    sequencerRatchetsDropped += entry->ratchet - entry->next;
+  }
+
+  entry->cmd = *cmd;
+  entry->cmd.lock.flags |= PLAYER_LOCK_RETRIGGER;
+  entry->due = due;
+  entry->stepLen = stepLen;
+  entry->micro = micro;
+  entry->ratchet = ratchet;
+  entry->next = 1;
+}
+
+/*
+ * queues the repeats which are due before the frame limit, the end of the block which is rendered next
+ */
+static void sequencerRatchetsDue(uint32_t limit)
+{
+  for (int i = 0; i < RINGS; i++)
+  {
+    for (int n = 0; n < SEQ_RATCHET_STEPS; n++)
+    {
+      struct seq_ratchet_s *e = &sequencerRatchets[i][n];
+      while (e->next < e->ratchet)
+      {
+        e->cmd.frame = (uint32_t)((e->due + (e->stepLen * e->next + e->ratchet - 1) / e->ratchet) >> 32) + e->micro;
+        if ((int32_t)(e->cmd.frame - limit) >= 0)
+        {
+          break;
+        }
+        AudioCmd_PushSorted(&audioLocalCmdQueue, &e->cmd);
+        e->next++;
+      }
+    }
+  }
+}
+
+/*
+ * advances all rings by one tick
+ * tick and tickLen are frames with 32 fractional bits, lead is the number of frames
+ * the tick is processed ahead of the audio, a step cannot be moved earlier than that
+ */
+void sequencerTick(uint64_t tick, uint64_t tickLen, int32_t lead)
+{
+  for (int i = 0; i < RINGS; i++)
+  {
+    if (seq_counter % divRatio[sequencerRings[i].clkDiv] == 0)
+    {
+      if (sequencerRings[i].activeNote + 1 >= sequencerRings[i].loopLength)
+        sequencerRings[i].activeNote = 0;
+      else
+        sequencerRings[i].activeNote += 1;
+
+      if (bitRead(sequencerRings[i].euclidNotes, sequencerRings[i].activeNote) || sequencerRings[i].hold)
+      {
+        const struct seq_step_s *step = &sequencerSteps[i][sequencerRings[i].activeNote];
+        if (!(step->lock.flags & SEQ_LOCK_PROBABILITY) || ((sequencerRandom() % 100) < step->probability))
+        {
+          uint64_t due = tick;
+          const uint64_t stepLen = tickLen * divRatio[sequencerRings[i].clkDiv];
+          uint8_t swing = (sequencerRings[i].swing != 0) ? sequencerRings[i].swing : sequencerSwing;
+          if ((sequencerRings[i].activeNote & 1) && (swing > SEQ_SWING_MIN))
+          {
+            /* rounded up like the tick length, the frame is exact for every tempo */
+            due += ((min(swing, (uint8_t)SEQ_SWING_MAX) - SEQ_SWING_MIN) * stepLen + 49) / 50;
+          }
+          int32_t micro = constrain(step->microTiming, -min(lead, (int32_t)SEQ_MICRO_TIMING_MAX), SEQ_MICRO_TIMING_MAX);
+          int ratchet = (stepLen != 0) ? constrain(step->ratchet, 1, SEQ_RATCHET_MAX) : 1;
+
+          struct audio_cmd_s cmd = {(uint32_t)(due >> 32) + micro, audio_cmd_sample_on, (uint8_t)i, 0, 0.0f, step->lock};
+          if ((sequencerRings[i].tune != 0) || (sequencerRings[i].fine != 0))
+          {
+            int cents = sequencerRings[i].tune * 100 + sequencerRings[i].fine;
+            if (cmd.lock.flags & PLAYER_LOCK_PITCH)
+            {
+              cents += cmd.lock.pitch * 100 + cmd.lock.fine;
+            }
+            cents = constrain(cents, PLAYER_PITCH_MIN, PLAYER_PITCH_MAX);
+            cmd.lock.flags |= PLAYER_LOCK_PITCH;
+            cmd.lock.pitch = cents / 100;
+            cmd.lock.fine = cents % 100;
+          }
+          AudioCmd_PushSorted(&audioLocalCmdQueue, &cmd);
+          if (ratchet > 1)
+          {
+            sequencerAddRatchet(i, &cmd, due, stepLen, micro, ratchet);
+          }
+        }
+      }
+      sequencerStepChanged = true;
+    }
+  }
+  if ((seq_counter + 1) > max_div)
+    seq_counter = 1;
+  else
+    seq_counter += 1;
+}
+
+void sequencerMidiCommands(void)
+{
+  struct audio_cmd_s *cmd;
+  while ((cmd = AudioCmd_Peek(&midiCmdQueue)) != NULL)
+  {
+    /* the frame of a midi command is its micros() timestamp */
+    uint32_t frame = AudioCmd_MicrosToFrame(cmd->frame);
+    uint64_t tickLen = (uint64_t)(midiClockFollower.period * SEQ_MIDI_PULSES_PER_TICK * 4294967296.0);
+
+    switch (cmd->type)
+    {
+      case audio_cmd_midi_start:
+        midi_clock = true;
+        seq_counter = 1;
+        for (int i = 0; i < RINGS; i++)
+        {
+          sequencerRings[i].activeNote = 0;
+        }
+        pulse_counter = 0;
+        ClockFollower_Reset(&midiClockFollower);
+        sequencerTick(((uint64_t)(frame + AUDIO_CMD_LATENCY)) << 32, 0, AUDIO_CMD_LATENCY);
+        break;
+      case audio_cmd_midi_stop:
+        midi_clock = false;
+        pulse_counter = 0;
+        break;
+      case audio_cmd_midi_clock:
+        if (midi_clock)
+        {
+          frame = ClockFollower_Pulse(&midiClockFollower, frame);
+          pulse_counter++;
+          if (! (pulse_counter % SEQ_MIDI_PULSES_PER_TICK))
+          {
+            sequencerTick(((uint64_t)(frame + AUDIO_CMD_LATENCY)) << 32, tickLen, AUDIO_CMD_LATENCY);
+          }
+          if (pulse_counter > 23) {
+            pulse_counter = 0;
+          }
+        }
+        break;
+    }
+    AudioCmd_Pop(&midiCmdQueue);
+  }
+}
+
+void sequencerCommands(void)
+{
+  struct audio_cmd_s *cmd;
+  while ((cmd = AudioCmd_Peek(&sequencerCmdQueue)) != NULL)
+  {
+    if (cmd->index < RINGS)
+    {
+      struct seq_ring_s *ring = &sequencerRings[cmd->index];
+      switch (cmd->type)
+      {
+        case audio_cmd_seq_pattern:
+          ring->loopLength = constrain(cmd->value, 1, SEQ_MAX_STEPS);
+          ring->euclidNotes = cmd->pattern;
+          break;
+        case audio_cmd_seq_div:
+          ring->clkDiv = constrain((int8_t)cmd->value, 0, (int8_t)(sizeof(divRatio) - 1));
+          break;
+        case audio_cmd_seq_hold:
+          ring->hold = (cmd->value != 0);
+          break;
+        case audio_cmd_seq_lock:
+          if (cmd->value < SEQ_MAX_STEPS)
+          {
+            struct seq_step_s *step = &sequencerSteps[cmd->index][cmd->value];
+            step->lock = cmd->step.lock;
+            step->probability = cmd->step.probability;
+            step->microTiming = (int32_t)cmd->frame;
+            step->ratchet = cmd->step.ratchet;
+          }
+          break;
+        case audio_cmd_seq_clear:
+          memset(sequencerSteps[cmd->index], 0, sizeof(sequencerSteps[cmd->index]));
+          break;
+        case audio_cmd_seq_tune:
+          ring->tune = constrain(cmd->lock.pitch, PLAYER_PITCH_MIN / 100, PLAYER_PITCH_MAX / 100);
+          ring->fine = constrain(cmd->lock.fine, -99, 99);
+          break;
+      }
+    }
+    AudioCmd_Pop(&sequencerCmdQueue);
+  }
+}
+
+/*
+ * runs the sequencer for the block starting at frame, called by the audio task before rendering
+ */
+void sequencerProcess(uint32_t frame, int buffLen)
+{
+  sequencerCommands();
+  sequencerMidiCommands();
+
+  if (midi_clock)
+  {
+    sequencerRatchetsDue(frame + buffLen);
+    return;
+  }
+
+  /*
+   * a tick is a 16th note, the length is rounded up:
+   * the error stays below one frame for 2^32 ticks and the ticks which fall exactly on a frame are not one frame early
+   */
+  const uint32_t bpmNow = bpm;
+  const uint64_t tickLen = ((((uint64_t)SAMPLE_RATE * 15) << 32) + bpmNow - 1) / bpmNow;
+  const uint64_t blockStart = ((uint64_t)frame) << 32;
+  const uint64_t blockEnd = ((uint64_t)(frame + buffLen)) << 32;
+  const uint64_t lookahead = ((uint64_t)SEQ_MICRO_TIMING_MAX) << 32;
+
+  if ((sequencerNextTick < blockStart) || (sequencerNextTick >= blockEnd + lookahead + (((uint64_t)SAMPLE_RATE * 60) << 32)))
+  {
+    /* start, after the midi clock stopped or when the frame counter wrapped */
+    sequencerNextTick = blockStart;
+  }
+
+  /* the ticks are processed ahead, so a step which is moved earlier is still in time */
+  while (sequencerNextTick < blockEnd + lookahead)
+  {
+    sequencerTick(sequencerNextTick, tickLen, (sequencerNextTick - blockStart) >> 32);
+    sequencerNextTick += tickLen;
+  }
+  sequencerRatchetsDue(frame + buffLen);
+}